@@ -0,0 +1,160 @@
+#include "activity.h"
+#include "exprreduction.h"
+#include "processor.h"
+
+#include <algorithm>
+#include <climits>
+#include <unordered_map>
+#include <unordered_set>
+
+// Samples [start, end) where a value can be non-zero
+struct Span {
+    int start;
+    int end;
+};
+
+static const Span FULL_SPAN = {INT_MIN, INT_MAX};
+static const Span EMPTY_SPAN = {0, 0};
+
+static Span intersect(Span a, Span b)
+{
+    Span span = {std::max(a.start, b.start), std::min(a.end, b.end)};
+    return span.start < span.end ? span : EMPTY_SPAN;
+}
+
+static Span hull(Span a, Span b)
+{
+    if (a.start >= a.end) return b;
+    if (b.start >= b.end) return a;
+    return {std::min(a.start, b.start), std::max(a.end, b.end)};
+}
+
+struct SpanState {
+    std::unordered_map<Wave*, Span> spans;
+    // Waves being worked out, and the ones found reading themselves through
+    // the others, which could see a block of their own delayed output
+    std::vector<Wave*> stack;
+    std::unordered_set<Wave*> cyclic;
+};
+
+static Span wave_span(std::shared_ptr<Wave> wave, SpanState& state);
+
+static Span expr_span(Expr* node, SpanState& state)
+{
+    switch (node->type) {
+        case NodeType::NumericLiteral:
+            return ((NumericLiteral*)node)->value == 0.0 ? EMPTY_SPAN : FULL_SPAN;
+        case NodeType::RuntimeValPointerNode: {
+            std::shared_ptr<RuntimeVal> value = ((RuntimeValPointerNode*)node)->value;
+            switch (value->type) {
+                case RuntimeType::Number:
+                    return std::static_pointer_cast<Number>(value)->value == 0.0 ? EMPTY_SPAN : FULL_SPAN;
+                case RuntimeType::Wave:
+                    return wave_span(std::static_pointer_cast<Wave>(value), state);
+                case RuntimeType::Buffer:
+                    // Plays back from sample 0
+                    return {0, (int)std::static_pointer_cast<Buffer>(value)->size()};
+                default:
+                    return FULL_SPAN;
+            }
+        }
+        case NodeType::SharedExprNode:
+            return expr_span(((SharedExprNode*)node)->shared->expr, state);
+        case NodeType::BinaryExpr: {
+            BinaryExpr* dnode = (BinaryExpr*)node;
+            if (dnode->op.type != TokenType::ArithmeticOperator) {
+                return FULL_SPAN;
+            }
+            if (dnode->op.value == "*") {
+                return intersect(expr_span(dnode->lhs, state), expr_span(dnode->rhs, state));
+            }
+            if (dnode->op.value == "/") {
+                return expr_span(dnode->lhs, state);
+            }
+            if (dnode->op.value == "+" || dnode->op.value == "-") {
+                return hull(expr_span(dnode->lhs, state), expr_span(dnode->rhs, state));
+            }
+            return FULL_SPAN;
+        }
+        case NodeType::UnaryExpr: {
+            UnaryExpr* dnode = (UnaryExpr*)node;
+            if (dnode->op.type != TokenType::ArithmeticOperator) {
+                return FULL_SPAN;
+            }
+            return expr_span(dnode->operand, state);
+        }
+        case NodeType::CallExpr: {
+            // Functions that keep 0 at 0
+            CallExpr* dnode = (CallExpr*)node;
+            std::string name = dnode->callee->name;
+            if (dnode->arguments->arguments.size() == 1
+                    && (name == "sin" || name == "abs" || name == "sqrt" || name == "floor")) {
+                return expr_span(dnode->arguments->arguments[0], state);
+            }
+            return FULL_SPAN;
+        }
+        default:
+            return FULL_SPAN;
+    }
+}
+
+static Span find_span(std::shared_ptr<Wave> wave, SpanState& state)
+{
+    Span declared = {wave->active_start, wave->active_end};
+
+    if (wave->processor != nullptr) {
+        Span span = FULL_SPAN;
+        wave->processor->span(span.start, span.end);
+        return span.start < span.end ? span : EMPTY_SPAN;
+    }
+    if (wave->decimator != nullptr || wave->fast_wave_expr == nullptr
+            || calls_function(wave, "rnd")) {
+        return intersect(declared, FULL_SPAN);
+    }
+
+    // The output is waveform * vol
+    Span vol = expr_span(wave->fast_vol_expr, state);
+    if (wave->vol_rate.rate == ParamRate::Control && vol.start < vol.end) {
+        // Interpolating reaches from the control point after the span
+        // starts, and from up to two points before it ends with cubic
+        vol.start = vol.start == INT_MIN ? INT_MIN : vol.start - wave->vol_rate.interval;
+        vol.end = vol.end == INT_MAX ? INT_MAX : vol.end + 2 * wave->vol_rate.interval;
+    }
+    Span span = intersect(expr_span(wave->fast_wave_expr, state), vol);
+    return intersect(declared, span);
+}
+
+static Span wave_span(std::shared_ptr<Wave> wave, SpanState& state)
+{
+    std::unordered_map<Wave*, Span>::iterator found = state.spans.find(wave.get());
+    if (found != state.spans.end()) {
+        return found->second;
+    }
+
+    std::vector<Wave*>::iterator on_stack = std::find(state.stack.begin(), state.stack.end(), wave.get());
+    if (on_stack != state.stack.end()) {
+        state.cyclic.insert(on_stack, state.stack.end());
+        return FULL_SPAN;
+    }
+
+    state.stack.push_back(wave.get());
+    Span span = find_span(wave, state);
+    state.stack.pop_back();
+
+    if (state.cyclic.count(wave.get())) {
+        span = intersect({wave->active_start, wave->active_end}, FULL_SPAN);
+    }
+    state.spans[wave.get()] = span;
+    return span;
+}
+
+void compute_spans(std::vector<std::shared_ptr<Wave>>& graph)
+{
+    SpanState state;
+
+    for (std::shared_ptr<Wave> wave : graph) {
+        Span span = wave_span(wave, state);
+        wave->span_start = span.start;
+        wave->span_end = span.end;
+    }
+}
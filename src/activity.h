@@ -0,0 +1,15 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "runtimeval.h"
+
+// Sets span_start and span_end of every wave in a prepared graph: the
+// declared active range, narrowed down by what the simplified exprs show.
+// A product is silent wherever a factor is, a sum wherever all its terms
+// are, and waves, envelopes, sequencers and buffers are silent outside
+// their own spans. Nothing is inferred for waves calling rnd, since
+// skipping their silence would move their random stream, or for
+// oversampled waves, whose filters ring past it.
+void compute_spans(std::vector<std::shared_ptr<Wave>>& graph);
@@ -1,8 +1,22 @@
 #include "ast.h"
+#include "stats.h"
 
 Stmt::Stmt(NodeType type, Token begin)
     : type(type), begin(begin) {}
 
+void* Stmt::operator new(size_t size)
+{
+    if (Azurite::Stats::enabled) {
+        Azurite::Stats::count_alloc(AllocCategory::AstNode, size);
+    }
+    return ::operator new(size);
+}
+
+void Stmt::operator delete(void* ptr)
+{
+    ::operator delete(ptr);
+}
+
 Stmts::Stmts(std::vector<Stmt*> stmts, Token begin)
     : Stmt(NodeType::Stmts, begin), stmts(stmts) {}
 Stmts::~Stmts()
@@ -46,7 +60,12 @@ AssignStmt::~AssignStmt()
 }
 
 FunctionDeclaration::FunctionDeclaration(Identifier* name, Parameters* params, Stmts* body, Token begin)
-    : Stmt(NodeType::FunctionDeclaration, begin), name(name), params(params), body(body), ref_count(1) {}
+    : Stmt(NodeType::FunctionDeclaration, begin), name(name), params(params), body(body), ref_count(1)
+{
+    // Done once here rather than when the declaration runs, so a parsed
+    // program can be shared by interpreters on several threads
+    mark_tail_calls(body);
+}
 FunctionDeclaration::~FunctionDeclaration()
 {
     delete name;
@@ -107,7 +126,7 @@ Identifier::Identifier(std::string name, Token begin)
     : Expr(NodeType::Identifier, begin), name(name) {}
 
 CallExpr::CallExpr(Identifier* callee, Arguments* arguments, Token begin)
-    : Expr(NodeType::CallExpr, begin), callee(callee), arguments(arguments) {}
+    : Expr(NodeType::CallExpr, begin), callee(callee), arguments(arguments), tail_call(false) {}
 CallExpr::~CallExpr()
 {
     delete callee;
@@ -137,10 +156,13 @@ WaveDeclaration::WaveDeclaration(
         Expr* phase_expr,
         Expr* vol_expr,
         Expr* pan_expr,
+        Expr* oversample_expr,
+        Expr* active_expr,
         Token begin
         )
     : Expr(NodeType::WaveDeclaration, begin),
-    wave_expr(wave_expr), freq_expr(freq_expr), phase_expr(phase_expr), vol_expr(vol_expr), pan_expr(pan_expr) {}
+    wave_expr(wave_expr), freq_expr(freq_expr), phase_expr(phase_expr), vol_expr(vol_expr), pan_expr(pan_expr),
+    oversample_expr(oversample_expr), active_expr(active_expr) {}
 WaveDeclaration::~WaveDeclaration()
 {
     // NOPE -Decrease each reference count and delete function if it reaches 0 NOPE
@@ -149,6 +171,47 @@ WaveDeclaration::~WaveDeclaration()
     delete phase_expr;
     delete vol_expr;
     delete pan_expr;
+    delete oversample_expr;
+    delete active_expr;
+}
+
+// Marks `return f(...)` in the body and its if statements. Not in for
+// loops: the loop's scope is gone by the time a tail call runs, and the
+// callee would lose the variables it could see there.
+static void mark_return_calls(Stmts* body)
+{
+    if (body == nullptr) return;
+
+    for (Stmt* stmt : body->stmts) {
+        if (stmt->type == NodeType::ReturnStmt) {
+            Expr* return_expr = ((ReturnStmt*)stmt)->return_expr;
+            if (return_expr->type == NodeType::CallExpr) {
+                ((CallExpr*)return_expr)->tail_call = true;
+            }
+        } else if (stmt->type == NodeType::IfStmt) {
+            mark_return_calls(((IfStmt*)stmt)->body);
+        }
+    }
+}
+
+// Marks a bare call that is the last statement executed, following
+// trailing if statements
+static void mark_last_call(Stmts* body)
+{
+    if (body == nullptr || body->stmts.empty()) return;
+
+    Stmt* last = body->stmts.back();
+    if (last->type == NodeType::CallExpr) {
+        ((CallExpr*)last)->tail_call = true;
+    } else if (last->type == NodeType::IfStmt) {
+        mark_last_call(((IfStmt*)last)->body);
+    }
+}
+
+void mark_tail_calls(Stmts* body)
+{
+    mark_return_calls(body);
+    mark_last_call(body);
 }
 
 void printAST(Stmt* node, int indent, bool in_list)
@@ -11,6 +11,7 @@ enum class NodeType
     // Expression
     RuntimeValPointerNode,
     NumberPointerNode,
+    SharedExprNode,
     NumericLiteral,
     StringLiteral,
     Identifier,
@@ -41,6 +42,10 @@ public:
 
     Stmt(NodeType type, Token begin);
     virtual ~Stmt() {}
+
+    // Counted for --stats
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
 };
 
 
@@ -150,6 +155,8 @@ class CallExpr : public Expr
 public:
     Identifier* callee;
     Arguments* arguments;
+    // Set by mark_tail_calls when the call is the last thing its function does
+    bool tail_call;
 
     CallExpr(Identifier* callee, Arguments* arguments, Token begin);
     ~CallExpr();
@@ -243,6 +250,10 @@ public:
     Expr* phase_expr;
     Expr* vol_expr;
     Expr* pan_expr;
+    // nullptr unless the wave sets its own oversampling factor
+    Expr* oversample_expr;
+    // nullptr unless the wave declares when it's active
+    Expr* active_expr;
 
     WaveDeclaration(
         Expr* wave_expr,
@@ -250,11 +261,17 @@ public:
         Expr* phase_expr,
         Expr* vol_expr,
         Expr* pan_expr,
+        Expr* oversample_expr,
+        Expr* active_expr,
         Token begin
     );
     ~WaveDeclaration();
 };
 
+// Flag calls in tail position of a function body so the interpreter can
+// run them in the caller's frame instead of recursing
+void mark_tail_calls(Stmts* body);
+
 void printAST(Stmt* node, int indent = 0, bool in_list = false);
 
 void formatNode(std::string name, Stmt* node, int indent);
@@ -0,0 +1,517 @@
+#include "astcache.h"
+#include "hash.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct azcHeader {
+    char magic[4] = {'A', 'Z', 'C', '\0'};
+    uint32_t format = AZC_FORMAT_VERSION;
+    uint64_t key;
+    uint64_t payload_size;
+};
+
+// Marks a missing child node
+#define AZC_NULL_NODE 0xff
+
+uint64_t program_cache_key(const std::string& source)
+{
+    std::string version = AZURITE_VERSION;
+    uint64_t hash = hash_bytes(version.data(), version.size());
+    return hash_bytes(source.data(), source.size(), hash);
+}
+
+std::string program_cache_path(const std::string& script_path)
+{
+    if (script_path.size() > 3 && script_path.compare(script_path.size() - 3, 3, ".az") == 0) {
+        return script_path + "c";
+    }
+    return script_path + ".azc";
+}
+
+// ---------------------------------------------------------------------------
+// Writing
+
+static void write_bytes(std::vector<char>& out, const void* data, size_t size)
+{
+    const char* bytes = (const char*)data;
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+static void write_u8(std::vector<char>& out, uint8_t value)
+{
+    out.push_back((char)value);
+}
+
+static void write_i32(std::vector<char>& out, int32_t value)
+{
+    write_bytes(out, &value, sizeof(value));
+}
+
+static void write_string(std::vector<char>& out, const std::string& value)
+{
+    write_i32(out, (int32_t)value.size());
+    write_bytes(out, value.data(), value.size());
+}
+
+static void write_token(std::vector<char>& out, const Token& token)
+{
+    write_u8(out, (uint8_t)token.type);
+    write_string(out, token.value);
+    write_i32(out, token.line);
+    write_i32(out, token.col);
+}
+
+static void write_node(std::vector<char>& out, Stmt* node)
+{
+    if (node == nullptr) {
+        write_u8(out, AZC_NULL_NODE);
+        return;
+    }
+
+    write_u8(out, (uint8_t)node->type);
+    write_token(out, node->begin);
+
+    switch (node->type) {
+        case NodeType::Program: {
+            write_node(out, ((Program*)node)->body);
+            break;
+        }
+        case NodeType::Stmts: {
+            Stmts* dnode = (Stmts*)node;
+            write_i32(out, (int32_t)dnode->stmts.size());
+            for (Stmt* stmt : dnode->stmts)
+                write_node(out, stmt);
+            break;
+        }
+        case NodeType::BinaryExpr: {
+            BinaryExpr* dnode = (BinaryExpr*)node;
+            write_node(out, dnode->lhs);
+            write_node(out, dnode->rhs);
+            write_token(out, dnode->op);
+            break;
+        }
+        case NodeType::UnaryExpr: {
+            UnaryExpr* dnode = (UnaryExpr*)node;
+            write_node(out, dnode->operand);
+            write_token(out, dnode->op);
+            break;
+        }
+        case NodeType::NumericLiteral: {
+            double value = ((NumericLiteral*)node)->value;
+            write_bytes(out, &value, sizeof(value));
+            break;
+        }
+        case NodeType::StringLiteral: {
+            write_string(out, ((StringLiteral*)node)->value);
+            break;
+        }
+        case NodeType::Identifier: {
+            write_string(out, ((Identifier*)node)->name);
+            break;
+        }
+        case NodeType::Arguments: {
+            Arguments* dnode = (Arguments*)node;
+            write_i32(out, (int32_t)dnode->arguments.size());
+            for (Expr* arg : dnode->arguments)
+                write_node(out, arg);
+            break;
+        }
+        case NodeType::Parameters: {
+            Parameters* dnode = (Parameters*)node;
+            write_i32(out, (int32_t)dnode->parameters.size());
+            for (Identifier* param : dnode->parameters)
+                write_node(out, param);
+            break;
+        }
+        case NodeType::CallExpr: {
+            CallExpr* dnode = (CallExpr*)node;
+            write_node(out, dnode->callee);
+            write_node(out, dnode->arguments);
+            break;
+        }
+        case NodeType::MemberExpr: {
+            MemberExpr* dnode = (MemberExpr*)node;
+            write_node(out, dnode->object);
+            write_node(out, dnode->index);
+            break;
+        }
+        case NodeType::ListDeclaration: {
+            ListDeclaration* dnode = (ListDeclaration*)node;
+            write_i32(out, (int32_t)dnode->elements.size());
+            for (Expr* element : dnode->elements)
+                write_node(out, element);
+            break;
+        }
+        case NodeType::WaveDeclaration: {
+            WaveDeclaration* dnode = (WaveDeclaration*)node;
+            write_node(out, dnode->wave_expr);
+            write_node(out, dnode->freq_expr);
+            write_node(out, dnode->phase_expr);
+            write_node(out, dnode->vol_expr);
+            write_node(out, dnode->pan_expr);
+            write_node(out, dnode->oversample_expr);
+            write_node(out, dnode->active_expr);
+            break;
+        }
+        case NodeType::AssignStmt: {
+            AssignStmt* dnode = (AssignStmt*)node;
+            write_node(out, dnode->lhs);
+            write_node(out, dnode->rhs);
+            break;
+        }
+        case NodeType::ForStmt: {
+            ForStmt* dnode = (ForStmt*)node;
+            write_node(out, dnode->iterator);
+            write_node(out, dnode->start);
+            write_node(out, dnode->end);
+            write_node(out, dnode->body);
+            break;
+        }
+        case NodeType::IfStmt: {
+            IfStmt* dnode = (IfStmt*)node;
+            write_node(out, dnode->condition);
+            write_node(out, dnode->body);
+            break;
+        }
+        case NodeType::FunctionDeclaration: {
+            FunctionDeclaration* dnode = (FunctionDeclaration*)node;
+            write_node(out, dnode->name);
+            write_node(out, dnode->params);
+            write_node(out, dnode->body);
+            break;
+        }
+        case NodeType::ReturnStmt: {
+            write_node(out, ((ReturnStmt*)node)->return_expr);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void serialize_program(Program* program, std::vector<char>& out)
+{
+    write_node(out, program);
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+
+class CacheReader
+{
+public:
+    const char* ptr;
+    const char* end;
+    bool failed;
+
+    CacheReader(const char* data, size_t size)
+        : ptr(data), end(data + size), failed(false) {}
+
+    bool read_bytes(void* dest, size_t size)
+    {
+        if (failed || (size_t)(end - ptr) < size) {
+            failed = true;
+            return false;
+        }
+        memcpy(dest, ptr, size);
+        ptr += size;
+        return true;
+    }
+
+    uint8_t read_u8()
+    {
+        uint8_t value = 0;
+        read_bytes(&value, sizeof(value));
+        return value;
+    }
+
+    int32_t read_i32()
+    {
+        int32_t value = 0;
+        read_bytes(&value, sizeof(value));
+        return value;
+    }
+
+    int32_t read_count()
+    {
+        int32_t count = read_i32();
+        if (count < 0 || count > end - ptr) {
+            failed = true;
+            return 0;
+        }
+        return count;
+    }
+
+    std::string read_string()
+    {
+        int32_t size = read_count();
+        if (failed) {
+            return "";
+        }
+        std::string value(ptr, size);
+        ptr += size;
+        return value;
+    }
+
+    Token read_token()
+    {
+        TokenType type = (TokenType)read_u8();
+        std::string value = read_string();
+        int line = read_i32();
+        int col = read_i32();
+        return Token(type, value, line, col);
+    }
+
+    Stmt* read_node();
+
+    Expr* read_expr()
+    {
+        Stmt* node = read_node();
+        if (node != nullptr && node->type >= NodeType::AssignStmt) {
+            failed = true;
+        }
+        return (Expr*)node;
+    }
+
+    template <class T>
+    T* read_typed(NodeType type)
+    {
+        Stmt* node = read_node();
+        if (node != nullptr && node->type != type) {
+            failed = true;
+        }
+        return (T*)node;
+    }
+};
+
+Stmt* CacheReader::read_node()
+{
+    uint8_t tag = read_u8();
+    if (failed || tag == AZC_NULL_NODE) {
+        return nullptr;
+    }
+
+    NodeType type = (NodeType)tag;
+    Token begin = read_token();
+    if (failed) {
+        return nullptr;
+    }
+
+    switch (type) {
+        case NodeType::Program: {
+            Stmts* body = read_typed<Stmts>(NodeType::Stmts);
+            return new Program(body, begin);
+        }
+        case NodeType::Stmts: {
+            std::vector<Stmt*> stmts;
+            int32_t count = read_count();
+            for (int i = 0; i < count && !failed; i++)
+                stmts.push_back(read_node());
+            return new Stmts(stmts, begin);
+        }
+        case NodeType::BinaryExpr: {
+            Expr* lhs = read_expr();
+            Expr* rhs = read_expr();
+            Token op = read_token();
+            return new BinaryExpr(lhs, rhs, op, begin);
+        }
+        case NodeType::UnaryExpr: {
+            Expr* operand = read_expr();
+            Token op = read_token();
+            return new UnaryExpr(operand, op, begin);
+        }
+        case NodeType::NumericLiteral: {
+            double value = 0.0;
+            read_bytes(&value, sizeof(value));
+            return new NumericLiteral(value, begin);
+        }
+        case NodeType::StringLiteral: {
+            return new StringLiteral(read_string(), begin);
+        }
+        case NodeType::Identifier: {
+            return new Identifier(read_string(), begin);
+        }
+        case NodeType::Arguments: {
+            std::vector<Expr*> arguments;
+            int32_t count = read_count();
+            for (int i = 0; i < count && !failed; i++)
+                arguments.push_back(read_expr());
+            return new Arguments(arguments, begin);
+        }
+        case NodeType::Parameters: {
+            std::vector<Identifier*> parameters;
+            int32_t count = read_count();
+            for (int i = 0; i < count && !failed; i++)
+                parameters.push_back(read_typed<Identifier>(NodeType::Identifier));
+            return new Parameters(parameters, begin);
+        }
+        case NodeType::CallExpr: {
+            Identifier* callee = read_typed<Identifier>(NodeType::Identifier);
+            Arguments* arguments = read_typed<Arguments>(NodeType::Arguments);
+            return new CallExpr(callee, arguments, begin);
+        }
+        case NodeType::MemberExpr: {
+            Expr* object = read_expr();
+            Expr* index = read_expr();
+            return new MemberExpr(object, index, begin);
+        }
+        case NodeType::ListDeclaration: {
+            std::vector<Expr*> elements;
+            int32_t count = read_count();
+            for (int i = 0; i < count && !failed; i++)
+                elements.push_back(read_expr());
+            return new ListDeclaration(elements, begin);
+        }
+        case NodeType::WaveDeclaration: {
+            Expr* wave_expr = read_expr();
+            Expr* freq_expr = read_expr();
+            Expr* phase_expr = read_expr();
+            Expr* vol_expr = read_expr();
+            Expr* pan_expr = read_expr();
+            Expr* oversample_expr = read_expr();
+            Expr* active_expr = read_expr();
+            return new WaveDeclaration(wave_expr, freq_expr, phase_expr, vol_expr, pan_expr, oversample_expr,
+                active_expr, begin);
+        }
+        case NodeType::AssignStmt: {
+            Expr* lhs = read_expr();
+            Expr* rhs = read_expr();
+            return new AssignStmt(lhs, rhs, begin);
+        }
+        case NodeType::ForStmt: {
+            Identifier* iterator = read_typed<Identifier>(NodeType::Identifier);
+            Expr* start = read_expr();
+            Expr* end = read_expr();
+            Stmts* body = read_typed<Stmts>(NodeType::Stmts);
+            return new ForStmt(iterator, start, end, body, begin);
+        }
+        case NodeType::IfStmt: {
+            Expr* condition = read_expr();
+            Stmts* body = read_typed<Stmts>(NodeType::Stmts);
+            return new IfStmt(condition, body, begin);
+        }
+        case NodeType::FunctionDeclaration: {
+            Identifier* name = read_typed<Identifier>(NodeType::Identifier);
+            Parameters* params = read_typed<Parameters>(NodeType::Parameters);
+            Stmts* body = read_typed<Stmts>(NodeType::Stmts);
+            return new FunctionDeclaration(name, params, body, begin);
+        }
+        case NodeType::ReturnStmt: {
+            return new ReturnStmt(read_expr(), begin);
+        }
+        default:
+            failed = true;
+            return nullptr;
+    }
+}
+
+Program* deserialize_program(const char* data, size_t size)
+{
+    CacheReader reader(data, size);
+    Stmt* node = reader.read_node();
+
+    if (reader.failed || node == nullptr || node->type != NodeType::Program || reader.ptr != reader.end) {
+        // Partially built trees own whatever they managed to read
+        delete node;
+        return nullptr;
+    }
+
+    return (Program*)node;
+}
+
+// ---------------------------------------------------------------------------
+// Files
+
+static Program* load_from_memory(const char* data, size_t size, uint64_t key)
+{
+    azcHeader header;
+
+    if (size < sizeof(header)) {
+        return nullptr;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, "AZC", 4) != 0
+        || header.format != AZC_FORMAT_VERSION
+        || header.key != key
+        || header.payload_size != size - sizeof(header)) {
+        return nullptr;
+    }
+
+    return deserialize_program(data + sizeof(header), header.payload_size);
+}
+
+Program* load_program_cache(const std::string& cache_path, uint64_t key)
+{
+#ifndef _WIN32
+    int fd = open(cache_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    Program* program = load_from_memory((const char*)data, st.st_size, key);
+    munmap(data, st.st_size);
+#else
+    std::ifstream file(cache_path, std::ios::in | std::ios::binary);
+    if (!file) {
+        return nullptr;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    Program* program = load_from_memory(data.data(), data.size(), key);
+#endif
+
+    AZ_LOG(Debug, Parser, (program ? "loaded " : "stale or missing ") << cache_path);
+
+    return program;
+}
+
+bool save_program_cache(const std::string& cache_path, uint64_t key, Program* program)
+{
+    std::vector<char> payload;
+    serialize_program(program, payload);
+
+    azcHeader header;
+    header.key = key;
+    header.payload_size = payload.size();
+
+    // Write to a temporary file and rename so readers never see a partial cache
+    std::string tmp_path = cache_path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::out | std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    file.write((const char*)&header, sizeof(header));
+    file.write(payload.data(), payload.size());
+    file.close();
+
+    if (!file || std::rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    AZ_LOG(Debug, Parser, "saved " << cache_path << " (" << payload.size() << " bytes)");
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "log.h"
+
+// Version of the Azurite front end. Bump it whenever the lexer, parser or
+// AST changes meaning so old .azc files stop matching.
+#define AZURITE_VERSION "0.2"
+#define AZC_FORMAT_VERSION 4
+
+// Key used to validate a cache file: hash of the source text and the version
+uint64_t program_cache_key(const std::string& source);
+
+// Cache file path for a script: "song.az" -> "song.azc"
+std::string program_cache_path(const std::string& script_path);
+
+// Returns nullptr if the cache is missing, stale or malformed
+Program* load_program_cache(const std::string& cache_path, uint64_t key);
+bool save_program_cache(const std::string& cache_path, uint64_t key, Program* program);
+
+// Serialize/deserialize a Program to/from a flat byte buffer
+void serialize_program(Program* program, std::vector<char>& out);
+Program* deserialize_program(const char* data, size_t size);
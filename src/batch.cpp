@@ -0,0 +1,193 @@
+#include "batch.h"
+#include "interpreter.h"
+#include "processor.h"
+#include "rendermanifest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+bool run_script(const std::string& path, const ScriptOptions& options, long* samples_written)
+{
+    std::ifstream source_file(path);
+    if (!source_file) {
+        std::cout << "Could not open " << path << "\n";
+        return false;
+    }
+
+    std::stringstream buffer;
+    buffer << source_file.rdbuf();
+
+    std::string source = buffer.str();
+    std::string cache_path = options.use_cache ? program_cache_path(path) : "";
+
+    try {
+        // Shared by both passes, so render() calls in the script (which the
+        // dry run has to do for real) aren't rendered twice
+        RenderCache render_cache;
+        std::unordered_set<std::string> render_buses;
+        std::unordered_map<std::string, RenderedOutput> outputs;
+
+        // The dry run is the only run when everything is up to date, so its
+        // print() calls are the ones that print
+        if (options.incremental) {
+            Interpreter dry_run;
+            dry_run.set_oversample(options.oversample);
+            dry_run.set_render_cache(&render_cache);
+            dry_run.set_dry_run(true);
+            dry_run.interpret(source, cache_path);
+
+            std::unordered_map<std::string, RenderedOutput> previous;
+            load_render_manifest(render_manifest_path(path), previous);
+
+            std::vector<std::string> buses = dry_run.output_buses();
+            std::vector<std::string> changed;
+            for (const std::string& bus : buses) {
+                RenderedOutput output;
+                if (dry_run.output_hash(bus, output.hash)) {
+                    outputs[bus] = output;
+                    // The file has to still be the one written last time
+                    RenderedOutput file;
+                    if (previous.count(bus) && previous[bus].hash == output.hash && stat_output(bus, file)
+                            && file.size == previous[bus].size && file.mtime == previous[bus].mtime) {
+                        continue;
+                    }
+                }
+                changed.push_back(bus);
+            }
+
+            if (changed.size() < buses.size()) {
+                std::cout << (buses.size() - changed.size()) << " of " << buses.size()
+                    << " outputs of " << path << " are up to date\n";
+            }
+            if (changed.empty()) {
+                if (samples_written != nullptr) {
+                    *samples_written = 0;
+                }
+                return true;
+            }
+
+            render_buses = dry_run.buses_feeding(changed);
+        }
+
+        Interpreter interpreter;
+        interpreter.set_threads(options.threads);
+        interpreter.set_oversample(options.oversample);
+        if (options.incremental) {
+            interpreter.set_render_cache(&render_cache);
+            interpreter.render_only(render_buses);
+            interpreter.mute_print(true);
+        }
+
+        interpreter.interpret(source, cache_path);
+
+        if (options.incremental) {
+            // Outputs that weren't written have nothing to compare against
+            for (auto it = outputs.begin(); it != outputs.end();) {
+                it = stat_output(it->first, it->second) ? std::next(it) : outputs.erase(it);
+            }
+            save_render_manifest(render_manifest_path(path), outputs);
+        } else {
+            // The files no longer match whatever it says
+            std::remove(render_manifest_path(path).c_str());
+        }
+
+        if (samples_written != nullptr) {
+            *samples_written = interpreter.samples_written();
+        }
+    } catch (ScriptError& e) {
+        std::cout << (path.empty() ? "" : path + ": ") << e.what() << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool read_manifest(const std::string& path, std::vector<std::string>& scripts)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Could not open manifest " << path << "\n";
+        return false;
+    }
+
+    std::string dir;
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos) {
+        dir = path.substr(0, slash + 1);
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        line.erase(0, line.find_first_not_of(" \t\r"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        scripts.push_back(line[0] == '/' ? line : dir + line);
+    }
+
+    return true;
+}
+
+int run_batch(const std::vector<std::string>& scripts, const ScriptOptions& options, int jobs)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    std::mutex report_mutex;
+    int failed = 0;
+    long total_samples = 0;
+    Clock::time_point batch_start = Clock::now();
+
+    // Jobs run side by side, so each script renders on a single thread
+    ScriptOptions job_options = options;
+    job_options.threads = 1;
+
+    auto run_job = [&](const std::string& path) {
+        Clock::time_point start = Clock::now();
+        long samples = 0;
+        bool ok = run_script(path, job_options, &samples);
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        // Formatted apart from std::cout so scripts' print() keeps its format
+        std::ostringstream report;
+        report << (ok ? "[ok]   " : "[fail] ") << path << "  "
+            << std::fixed << std::setprecision(1) << ms << " ms, " << samples << " samples\n";
+
+        std::lock_guard<std::mutex> lock(report_mutex);
+        std::cout << report.str();
+        if (!ok) {
+            failed++;
+        }
+        total_samples += samples;
+    };
+
+    if (jobs <= 1) {
+        for (const std::string& path : scripts) {
+            run_job(path);
+        }
+    } else {
+        // The calling thread works through the queue too
+        ThreadPool pool(std::min(jobs, (int)scripts.size()) - 1);
+        for (const std::string& path : scripts) {
+            pool.submit([&run_job, &path] { run_job(path); });
+        }
+        pool.wait();
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - batch_start).count();
+    double audio_seconds = (double)total_samples / SAMPLE_RATE;
+
+    std::ostringstream summary;
+    summary << scripts.size() << " scripts (" << failed << " failed) in "
+        << std::fixed << std::setprecision(2) << seconds << " s, "
+        << scripts.size() / seconds << " scripts/s, "
+        << audio_seconds / seconds << "x realtime\n";
+    std::cout << summary.str();
+
+    return failed;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Settings shared by every script a process runs
+struct ScriptOptions {
+    int threads = 1;
+    int oversample = 1;
+    bool use_cache = true;
+    // Skip .wav outputs whose inputs haven't changed since the last run
+    // (--incremental). Costs a dry run of the script first.
+    bool incremental = false;
+};
+
+// Run one script in its own Interpreter. Errors are printed, not thrown.
+bool run_script(const std::string& path, const ScriptOptions& options, long* samples_written = nullptr);
+
+// Scripts listed one per line; blank lines and lines starting with # are
+// skipped. Relative paths are taken relative to the manifest.
+bool read_manifest(const std::string& path, std::vector<std::string>& scripts);
+
+// Run scripts on a pool of jobs threads, one Interpreter per script, and
+// report per-script timing and overall throughput. Returns the number of
+// scripts that failed.
+int run_batch(const std::vector<std::string>& scripts, const ScriptOptions& options, int jobs);
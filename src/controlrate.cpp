@@ -0,0 +1,227 @@
+#include "controlrate.h"
+#include "exprreduction.h"
+#include "processor.h"
+#include "hash.h"
+#include "error.h"
+
+#include <cmath>
+#include <unordered_set>
+
+// Whole blocks of control points, see CONTROL_RATE_INTERVAL
+#define MAX_CONTROL_INTERVAL 256
+
+ControlParam::ControlParam()
+    : rate(ParamRate::Audio), interval(CONTROL_RATE_INTERVAL), cubic(false), annotated(false)
+{
+    reset();
+}
+
+void ControlParam::reset()
+{
+    constant = nullptr;
+    started = false;
+    before_time = last_time = next_time = 0;
+    before = last = next = 0.0;
+}
+
+double ControlParam::at(int time)
+{
+    if (next_time == last_time) {
+        return next;
+    }
+
+    double span = next_time - last_time;
+    double t = (time - last_time) / span;
+    if (!cubic) {
+        return last + (next - last) * t;
+    }
+
+    // Hermite, with the slope through the point before at the start and
+    // the slope of this interval at the end
+    double start_slope = before_time != last_time ? (next - before) / (next_time - before_time) : (next - last) / span;
+    double end_slope = (next - last) / span;
+    double t2 = t * t;
+    double t3 = t2 * t;
+    return (2 * t3 - 3 * t2 + 1) * last + (t3 - 2 * t2 + t) * span * start_slope
+        + (-2 * t3 + 3 * t2) * next + (t3 - t2) * span * end_slope;
+}
+
+void ControlParam::hash(uint64_t& hash)
+{
+    // The other rates give the same samples as evaluating every point
+    if (rate == ParamRate::Control) {
+        hash = hash_value(rate, hash);
+        hash = hash_value(interval, hash);
+        hash = hash_value(cubic, hash);
+    }
+}
+
+bool take_rate_annotation(Expr*& slot, ControlParam& param, std::function<std::shared_ptr<RuntimeVal>(Expr*)> evaluate)
+{
+    if (slot->type != NodeType::CallExpr) {
+        return false;
+    }
+    CallExpr* call = (CallExpr*)slot;
+    std::string name = call->callee->name;
+    std::vector<Expr*>& args = call->arguments->arguments;
+
+    if (name == "audio") {
+        if (args.size() != 1) {
+            script_error("audio(expr) takes 1 argument.");
+        }
+        param.rate = ParamRate::Audio;
+    } else if (name == "control") {
+        if (args.size() < 1 || args.size() > 3) {
+            script_error("control(expr, interval, mode) takes 1 to 3 arguments.");
+        }
+        param.rate = ParamRate::Control;
+        param.interval = CONTROL_RATE_INTERVAL;
+        param.cubic = false;
+
+        if (args.size() > 1) {
+            std::shared_ptr<RuntimeVal> interval = evaluate(args[1]);
+            if (interval->type != RuntimeType::Number) {
+                script_error("control() interval must be a number.");
+            }
+            double value = std::static_pointer_cast<Number>(interval)->value;
+            int samples = (int)value;
+            if (samples != value || samples < 1 || samples > MAX_CONTROL_INTERVAL || (samples & (samples - 1)) != 0) {
+                script_error("control() interval must be a power of 2 from 1 to 256.");
+            }
+            param.interval = samples;
+        }
+        if (args.size() > 2) {
+            std::shared_ptr<RuntimeVal> mode = evaluate(args[2]);
+            std::string mode_name = mode->type == RuntimeType::String ? std::static_pointer_cast<String>(mode)->value : "";
+            if (mode_name == "cubic") {
+                param.cubic = true;
+            } else if (mode_name != "linear") {
+                script_error("control() mode must be \"linear\" or \"cubic\".");
+            }
+        }
+    } else {
+        return false;
+    }
+
+    param.annotated = true;
+    slot = args[0];
+    args[0] = nullptr;
+    delete call;
+    return true;
+}
+
+// Continuous in its inputs, and only reading slow waves. x counts when
+// allow_x is set; signal is set if a wave is read.
+static bool is_smooth(Expr* node, bool allow_x, bool& signal, std::unordered_set<Wave*>& visiting);
+
+static bool is_slow(Wave* wave, std::unordered_set<Wave*>& visiting)
+{
+    if (wave->processor != nullptr) {
+        return wave->processor->smooth();
+    }
+    if (wave->decimator != nullptr || wave->fast_wave_expr == nullptr) {
+        return false;
+    }
+    // Feedback isn't slow just because it's quiet
+    if (visiting.count(wave)) {
+        return false;
+    }
+    visiting.insert(wave);
+
+    bool slow = false;
+    Expr* freq = wave->fast_freq_expr;
+    double freq_value = 0.0;
+    bool constant_freq = true;
+    if (freq->type == NodeType::NumericLiteral) {
+        freq_value = ((NumericLiteral*)freq)->value;
+    } else if (freq->type == NodeType::RuntimeValPointerNode
+            && ((RuntimeValPointerNode*)freq)->value->type == RuntimeType::Number) {
+        freq_value = std::static_pointer_cast<Number>(((RuntimeValPointerNode*)freq)->value)->value;
+    } else {
+        constant_freq = false;
+    }
+
+    if (constant_freq && std::abs(freq_value) <= CONTROL_RATE_MAX_FREQ) {
+        // x in the waveform is the phase, which moves slowly at this frequency.
+        // In the other slots it's time.
+        bool signal = false;
+        slow = is_smooth(wave->fast_wave_expr, true, signal, visiting)
+            && is_smooth(wave->fast_phase_expr, false, signal, visiting)
+            && is_smooth(wave->fast_vol_expr, false, signal, visiting);
+    }
+
+    visiting.erase(wave);
+    return slow;
+}
+
+static bool is_smooth(Expr* node, bool allow_x, bool& signal, std::unordered_set<Wave*>& visiting)
+{
+    switch (node->type) {
+        case NodeType::NumericLiteral:
+            return true;
+        case NodeType::NumberPointerNode:
+            return allow_x;
+        case NodeType::RuntimeValPointerNode: {
+            std::shared_ptr<RuntimeVal> value = ((RuntimeValPointerNode*)node)->value;
+            if (value->type == RuntimeType::Number) {
+                return true;
+            }
+            if (value->type == RuntimeType::Wave) {
+                signal = true;
+                return is_slow((Wave*)value.get(), visiting);
+            }
+            return false;
+        }
+        case NodeType::SharedExprNode:
+            return is_smooth(((SharedExprNode*)node)->shared->expr, allow_x, signal, visiting);
+        case NodeType::BinaryExpr: {
+            BinaryExpr* dnode = (BinaryExpr*)node;
+            if (dnode->op.type != TokenType::ArithmeticOperator || dnode->op.value == "%") {
+                return false;
+            }
+            return is_smooth(dnode->lhs, allow_x, signal, visiting) && is_smooth(dnode->rhs, allow_x, signal, visiting);
+        }
+        case NodeType::UnaryExpr: {
+            UnaryExpr* dnode = (UnaryExpr*)node;
+            if (dnode->op.type != TokenType::ArithmeticOperator) {
+                return false;
+            }
+            return is_smooth(dnode->operand, allow_x, signal, visiting);
+        }
+        case NodeType::CallExpr: {
+            CallExpr* dnode = (CallExpr*)node;
+            std::string name = dnode->callee->name;
+            if (name != "sin" && name != "sqrt" && name != "abs") {
+                return false;
+            }
+            for (Expr* arg : dnode->arguments->arguments) {
+                if (!is_smooth(arg, allow_x, signal, visiting)) return false;
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+ParamRate classify_param(Expr* node)
+{
+    if (!is_repeatable(node) || reads_x(node)) {
+        return ParamRate::Audio;
+    }
+
+    // Constant subtrees are already folded, anything else is reading waves
+    // or buffers
+    std::unordered_set<Wave*> visiting;
+    bool signal = false;
+    if (!is_smooth(node, false, signal, visiting)) {
+        return ParamRate::Audio;
+    }
+    return signal ? ParamRate::Control : ParamRate::Constant;
+}
+
+bool is_slow_wave(Wave* wave)
+{
+    std::unordered_set<Wave*> visiting;
+    return is_slow(wave, visiting);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#include "ast.h"
+
+class RuntimeVal;
+class Wave;
+
+// Samples between control points when a slot doesn't pick its own. Has to
+// divide BLOCK_SIZE so control points line up with blocks.
+#define CONTROL_RATE_INTERVAL 16
+// Waves at or below this frequency (LFOs) are slow enough to read at
+// control rate
+#define CONTROL_RATE_MAX_FREQ 20.0
+
+// How often one of a wave's freq, phase and vol slots is evaluated
+enum class ParamRate {
+    // Every sample point
+    Audio,
+    // Once per render
+    Constant,
+    // Every interval samples, interpolated in between
+    Control
+};
+
+// The rate of a slot and, at control rate, the points it's interpolating
+// between. Control points are on the last sample of each interval, so the
+// samples in between are always bracketed by points already evaluated.
+class ControlParam
+{
+public:
+    ParamRate rate;
+    int interval;
+    // Cubic Hermite instead of linear. Tangents come from the points before
+    // and the new point, there's no looking past the block.
+    bool cubic;
+    // Set by a control() or audio() annotation rather than worked out
+    bool annotated;
+
+    std::shared_ptr<RuntimeVal> constant;
+
+    bool started;
+    int before_time, last_time, next_time;
+    double before, last, next;
+
+    ControlParam();
+
+    // Forget the values from the last render
+    void reset();
+    // Where the next control point goes after last_time, clamped to the
+    // last sample of the block
+    int next_point(int time, int block_end) { return std::min(time / interval * interval + interval - 1, block_end); }
+    double at(int time);
+    void hash(uint64_t& hash);
+};
+
+// control(expr[, interval[, "cubic"]]) or audio(expr) wrapped around a whole
+// slot: replaces the call with expr and sets param from it. evaluate works
+// out the interval and mode. Returns false if there was no annotation.
+bool take_rate_annotation(Expr*& slot, ControlParam& param, std::function<std::shared_ptr<RuntimeVal>(Expr*)> evaluate);
+
+// Rate for a simplified slot without an annotation. Slots reading x stay at
+// audio rate, since nothing says how fast x moves through them, but slots
+// only reading slow waves (see is_slow_wave) through smooth operations go to
+// control rate.
+ParamRate classify_param(Expr* node);
+
+// True if a wave's output changes slowly and smoothly enough to be sampled
+// every CONTROL_RATE_INTERVAL samples: envelopes, and waves with a low
+// constant frequency and smooth expressions of x and other slow waves
+bool is_slow_wave(Wave* wave);
@@ -0,0 +1,81 @@
+#include "convolver.h"
+
+#include <algorithm>
+
+Convolver::Convolver(const std::vector<double>& impulse, int block_size)
+    : block(block_size), bins(block_size + 1), fft(2 * block_size), head(0)
+{
+    int count = std::max(1, (int)((impulse.size() + block - 1) / block));
+
+    partitions.resize(count);
+    scratch.resize(2 * block);
+
+    for (int p = 0; p < count; p++) {
+        std::fill(scratch.begin(), scratch.end(), Complex(0.0, 0.0));
+        for (int i = 0; i < block && p * block + i < impulse.size(); i++) {
+            scratch[i] = impulse[p * block + i];
+        }
+        fft.forward(scratch);
+        partitions[p].assign(scratch.begin(), scratch.begin() + bins);
+    }
+
+    history.assign(count, std::vector<Complex>(bins));
+    window.resize(2 * block);
+    sum.resize(bins);
+
+    reset();
+}
+
+int Convolver::block_size()
+{
+    return block;
+}
+
+void Convolver::reset()
+{
+    for (std::vector<Complex>& spectrum : history) {
+        std::fill(spectrum.begin(), spectrum.end(), Complex(0.0, 0.0));
+    }
+    std::fill(window.begin(), window.end(), 0.0);
+    head = 0;
+}
+
+void Convolver::process(const double* in, double* out)
+{
+    // Slide the input window along by one block
+    std::copy(window.begin() + block, window.end(), window.begin());
+    std::copy(in, in + block, window.begin() + block);
+
+    for (int i = 0; i < 2 * block; i++) {
+        scratch[i] = window[i];
+    }
+    fft.forward(scratch);
+
+    head = (head + history.size() - 1) % history.size();
+    std::copy(scratch.begin(), scratch.begin() + bins, history[head].begin());
+
+    // Partition p meets the input from p blocks ago. The input is real, so
+    // only the lower half of the spectrum has to be multiplied.
+    std::fill(sum.begin(), sum.end(), Complex(0.0, 0.0));
+    for (int p = 0; p < partitions.size(); p++) {
+        const Complex* x = history[(head + p) % history.size()].data();
+        const Complex* h = partitions[p].data();
+        for (int k = 0; k < bins; k++) {
+            sum[k] += x[k] * h[k];
+        }
+    }
+
+    for (int k = 0; k < bins; k++) {
+        scratch[k] = sum[k];
+    }
+    for (int k = bins; k < 2 * block; k++) {
+        scratch[k] = std::conj(sum[2 * block - k]);
+    }
+    fft.inverse(scratch);
+
+    // The first half wrapped around (circular convolution), the second half
+    // is the linear convolution for this block
+    for (int i = 0; i < block; i++) {
+        out[i] = scratch[block + i].real();
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "fft.h"
+
+// Uniformly partitioned overlap-save convolution. The impulse response is
+// cut into partitions of block_size samples, each kept as a spectrum. Every
+// input block is transformed once, pushed onto a delay line of spectra and
+// multiplied against all partitions, so a block costs one forward and one
+// inverse FFT of 2 * block_size plus P spectrum products, instead of
+// block_size * impulse length multiplies.
+class Convolver
+{
+public:
+    Convolver(const std::vector<double>& impulse, int block_size);
+    ~Convolver() {}
+
+    int block_size();
+    // Silence the delay line, as if nothing had been fed in yet
+    void reset();
+    // Convolve the next block_size input samples into out. The output has
+    // no latency: out[i] includes in[i] * impulse[0].
+    void process(const double* in, double* out);
+
+private:
+    int block;
+    int bins;
+    FFT fft;
+
+    // Spectra of the impulse partitions, bins entries each
+    std::vector<std::vector<Complex>> partitions;
+    // Spectra of the last partitions.size() input blocks, newest at head
+    std::vector<std::vector<Complex>> history;
+    int head;
+
+    // The previous and current input blocks, back to back
+    std::vector<double> window;
+    std::vector<Complex> scratch;
+    std::vector<Complex> sum;
+};
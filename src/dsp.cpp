@@ -0,0 +1,142 @@
+#include "dsp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+double dot_product(const double* a, const double* b, int n)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    // Two accumulators to hide the add latency
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4) {
+        sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+    double sum = lanes[0] + lanes[1];
+#else
+    double sum = 0.0;
+#endif
+
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+void mix_add(float* dst, const float* src, int n, float gain)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), g));
+        _mm_storeu_ps(dst + i, sum);
+    }
+#endif
+
+    for (; i < n; i++) {
+        dst[i] += src[i] * gain;
+    }
+}
+
+void mix_add(float* dst, const double* src, int n, float gain)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    // Narrow two doubles at a time and pair them up into four floats
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4) {
+        __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+        __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+        __m128 samples = _mm_movelh_ps(lo, hi);
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(samples, g)));
+    }
+#endif
+
+    for (; i < n; i++) {
+        dst[i] += (float)src[i] * gain;
+    }
+}
+
+// Blackman windowed sinc with its cutoff a little under the output Nyquist
+// frequency, normalised to unity gain at DC
+static std::vector<double> make_taps(int factor)
+{
+    int length = 2 * DECIMATOR_HALF_TAPS * factor + 1;
+    int centre = length / 2;
+    double cutoff = 0.45 / factor;
+
+    std::vector<double> taps(length);
+    double total = 0.0;
+
+    for (int i = 0; i < length; i++) {
+        double t = i - centre;
+        double sinc = t == 0 ? 2.0 * cutoff : std::sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+        double window = 0.42 - 0.5 * std::cos(2.0 * M_PI * i / (length - 1))
+            + 0.08 * std::cos(4.0 * M_PI * i / (length - 1));
+        taps[i] = sinc * window;
+        total += taps[i];
+    }
+
+    for (double& tap : taps) {
+        tap /= total;
+    }
+    return taps;
+}
+
+// Shared by every decimator with the same factor
+static const std::vector<double>& decimation_taps(int factor)
+{
+    static std::mutex mutex;
+    static std::vector<double> tables[9];
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tables[factor].empty()) {
+        tables[factor] = make_taps(factor);
+    }
+    return tables[factor];
+}
+
+Decimator::Decimator(int factor)
+    : n(factor), taps(decimation_taps(factor))
+{
+    reset();
+}
+
+int Decimator::factor()
+{
+    return n;
+}
+
+void Decimator::reset()
+{
+    history.assign(taps.size() - 1, 0.0);
+}
+
+void Decimator::process(const double* in, double* out, int count)
+{
+    int kept = taps.size() - 1;
+
+    history.insert(history.end(), in, in + count * n);
+
+    // The taps are symmetric, so no need to reverse them. Output i lines up
+    // with the last input of its group.
+    for (int i = 0; i < count; i++) {
+        out[i] = dot_product(taps.data(), history.data() + i * n + n - 1, taps.size());
+    }
+
+    std::copy(history.end() - kept, history.end(), history.begin());
+    history.resize(kept);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+// Taps on each side of the decimation filter's centre, in output samples.
+// The filter delays an oversampled wave by this many samples.
+#define DECIMATOR_HALF_TAPS 32
+
+// Sum of a[i] * b[i], vectorised where the target has SSE2
+double dot_product(const double* a, const double* b, int n);
+
+// dst[i] += src[i] * gain, vectorised where the target has SSE2
+void mix_add(float* dst, const float* src, int n, float gain);
+void mix_add(float* dst, const double* src, int n, float gain);
+
+
+// Brings a wave rendered at factor x the sample rate back down. The
+// windowed-sinc lowpass is evaluated polyphase style: only at the kept
+// output positions, so the cost is per output sample, not per input.
+class Decimator
+{
+public:
+    Decimator(int factor);
+    ~Decimator() {}
+
+    int factor();
+    void reset();
+    // Filter count * factor input samples down to count output samples
+    void process(const double* in, double* out, int count);
+
+private:
+    int n;
+    const std::vector<double>& taps;
+    // The last taps.size() - 1 inputs followed by the block being filtered
+    std::vector<double> history;
+};
@@ -0,0 +1,115 @@
+#include "envelope.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+EnvelopeProcessor::EnvelopeProcessor(std::vector<double> times, std::vector<double> values)
+    : times(times), values(values) {}
+
+void EnvelopeProcessor::process(std::vector<double>& out, int start, int count)
+{
+    int last = times.size() - 1;
+    int i = 0;
+
+    while (i < count) {
+        double n = start + i;
+        int seg = std::upper_bound(times.begin(), times.end(), n) - times.begin() - 1;
+
+        if (seg < 0 || seg >= last) {
+            // Flat before the first point and after the last
+            double value = seg < 0 ? values[0] : values[last];
+            int end = seg < 0 ? std::min(count, i + (int)std::ceil(times[0] - n)) : count;
+            for (; i < end; i++) {
+                out[i] = value;
+            }
+            continue;
+        }
+
+        double slope = (values[seg + 1] - values[seg]) / (times[seg + 1] - times[seg]);
+        double value = values[seg] + slope * (n - times[seg]);
+        int end = std::min(count, i + (int)std::ceil(times[seg + 1] - n));
+
+        for (; i < end; i++) {
+            out[i] = value;
+            value += slope;
+        }
+    }
+}
+
+bool EnvelopeProcessor::hash(uint64_t& hash)
+{
+    hash = hash_string("env", hash);
+    hash = hash_value(times.size(), hash);
+    hash = hash_bytes(times.data(), times.size() * sizeof(double), hash);
+    hash = hash_bytes(values.data(), values.size() * sizeof(double), hash);
+    return true;
+}
+
+bool EnvelopeProcessor::smooth()
+{
+    for (int i = 1; i < times.size(); i++) {
+        if (times[i] - times[i - 1] < CONTROL_RATE_INTERVAL && values[i] != values[i - 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void EnvelopeProcessor::span(int& start, int& end)
+{
+    int first = 0;
+    while (first < values.size() && values[first] == 0.0) {
+        first++;
+    }
+    if (first == values.size()) {
+        end = start;
+        return;
+    }
+    // Zero up to the point before the first non-zero one, and from the
+    // point after the last one
+    if (first > 0) {
+        start = std::max(start, (int)std::floor(times[first - 1]));
+    }
+    int last = values.size() - 1;
+    while (values[last] == 0.0) {
+        last--;
+    }
+    if (last < values.size() - 1) {
+        end = std::min(end, (int)std::ceil(times[last + 1]) + 1);
+    }
+}
+
+void adsr_points(double attack, double decay, double sustain, double release, double hold,
+    std::vector<double>& times, std::vector<double>& values)
+{
+    times = {0.0, attack, attack + decay};
+    values = {0.0, 1.0, sustain};
+
+    if (hold < 0) {
+        return;
+    }
+
+    // Released early: cut the curve at the gate and fall from there
+    while (times.size() > 1 && times.back() > hold) {
+        double t0 = times[times.size() - 2];
+        double v0 = values[values.size() - 2];
+        double level = times.back() > t0
+            ? v0 + (values.back() - v0) * (hold - t0) / (times.back() - t0)
+            : values.back();
+
+        times.pop_back();
+        values.pop_back();
+        if (hold > t0) {
+            times.push_back(hold);
+            values.push_back(level);
+        }
+    }
+
+    if (times.back() < hold) {
+        times.push_back(hold);
+        values.push_back(values.back());
+    }
+    times.push_back(hold + release);
+    values.push_back(0.0);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "processor.h"
+
+// Piecewise linear envelope through (time, value) breakpoints, times in
+// samples. Holds the first value before the first point and the last one
+// after the last. Each segment is filled by adding its slope per sample,
+// starting from the exact value wherever a block begins.
+class EnvelopeProcessor : public WaveProcessor
+{
+public:
+    EnvelopeProcessor(std::vector<double> times, std::vector<double> values);
+    ~EnvelopeProcessor() {}
+
+    void reset() {}
+    void process(std::vector<double>& out, int start, int count);
+    bool hash(uint64_t& hash);
+    // The output only depends on the sample position
+    bool stateless() { return true; }
+    // No segment shorter than a control interval (a click)
+    bool smooth();
+    void span(int& start, int& end);
+
+private:
+    std::vector<double> times;
+    std::vector<double> values;
+};
+
+// Breakpoints for an ADSR envelope, times in seconds. The gate is held for
+// hold seconds then released; a negative hold never releases.
+void adsr_points(double attack, double decay, double sustain, double release, double hold,
+    std::vector<double>& times, std::vector<double>& values);
@@ -1,22 +1,26 @@
 #include "environment.h"
+#include "stats.h"
 
-Environment::~Environment()
+// Function declarations are nodes of the Program, which owns them
+Environment::~Environment() {}
+
+void* Environment::operator new(size_t size)
 {
-    /*for (std::unordered_map<std::string, RuntimeValPtr>::iterator it = var_map.begin();
-            it != var_map.end(); it++) {
-        delete it->second;
-    }*/
-    for (std::unordered_map<std::string, FunctionDeclaration*>::iterator it = func_map.begin();
-            it != func_map.end(); it++) {
-        delete it->second;
+    if (Azurite::Stats::enabled) {
+        Azurite::Stats::count_alloc(AllocCategory::Environment, size);
     }
+    return ::operator new(size);
+}
+
+void Environment::operator delete(void* ptr)
+{
+    ::operator delete(ptr);
 }
 
 RuntimeValPtr Environment::get_var(std::string name)
 {
     if (!var_map.count(name)) {
-        std::cout << "Undeclared variable " << name << ".\n";
-        exit(1);
+        script_error("Undeclared variable " + name + ".");
     }
     return var_map[name];
 }
@@ -29,8 +33,7 @@ void Environment::create_var(std::string name, RuntimeValPtr value)
 FunctionDeclaration* Environment::get_func(std::string name)
 {
     if (!func_map.count(name)) {
-        std::cout << "Undeclared function " << name << ".\n";
-        exit(1);
+        script_error("Undeclared function " + name + ".");
     }
     return func_map[name];
 }
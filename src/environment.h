@@ -7,6 +7,7 @@
 
 #include "ast.h"
 #include "runtimeval.h"
+#include "error.h"
 
 typedef std::shared_ptr<RuntimeVal> RuntimeValPtr;
 
@@ -19,6 +20,10 @@ public:
     Environment() {}
     ~Environment();
 
+    // Counted for --stats
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
+
     RuntimeValPtr get_var(std::string name);
     void create_var(std::string name, RuntimeValPtr val);
 
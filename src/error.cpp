@@ -1,8 +1,12 @@
 #include "error.h"
 
+void script_error(std::string msg)
+{
+    throw ScriptError(msg);
+}
+
 void runtime_error(std::string msg, Token token)
 {
-    std::cout << "Runtime error: " << msg;
-    std::cout << " Line " << token.line << ", col " << token.col << std::endl;
-    exit(1);
-}
\ No newline at end of file
+    throw ScriptError("Runtime error: " + msg
+        + " Line " + std::to_string(token.line) + ", col " + std::to_string(token.col));
+}
@@ -1,8 +1,18 @@
 #pragma once
 
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
 #include "token.h"
 
-void runtime_error(std::string msg, Token token);
\ No newline at end of file
+// Thrown for any error in a script. Whoever runs the script reports it;
+// one bad script doesn't take down others running in the same process.
+class ScriptError : public std::runtime_error
+{
+public:
+    ScriptError(const std::string& msg) : std::runtime_error(msg) {}
+};
+
+[[noreturn]] void script_error(std::string msg);
+[[noreturn]] void runtime_error(std::string msg, Token token);
@@ -1,7 +1,665 @@
 #include "exprreduction.h"
+#include "runtimelib.h"
+#include "processor.h"
+#include "wavegraph.h"
+#include "hash.h"
+
+#include <unordered_map>
+#include <unordered_set>
 
 RuntimeValPointerNode::RuntimeValPointerNode(std::shared_ptr<RuntimeVal> value, Token begin)
     : Expr(NodeType::RuntimeValPointerNode, begin), value(value) {}
 
 NumberPointerNode::NumberPointerNode(double* value, Token begin)
     : Expr(NodeType::NumberPointerNode, begin), value(value) {}
+
+void collect_wave_refs(Expr* node, std::vector<std::shared_ptr<Wave>>& refs)
+{
+    if (node == nullptr) return;
+
+    switch (node->type) {
+        case NodeType::RuntimeValPointerNode: {
+            RuntimeValPointerNode* dnode = (RuntimeValPointerNode*)node;
+            if (dnode->value->type == RuntimeType::Wave) {
+                refs.push_back(std::static_pointer_cast<Wave>(dnode->value));
+            }
+            break;
+        }
+        case NodeType::CallExpr: {
+            for (Expr* arg : ((CallExpr*)node)->arguments->arguments) {
+                collect_wave_refs(arg, refs);
+            }
+            break;
+        }
+        case NodeType::MemberExpr: {
+            collect_wave_refs(((MemberExpr*)node)->object, refs);
+            collect_wave_refs(((MemberExpr*)node)->index, refs);
+            break;
+        }
+        case NodeType::BinaryExpr: {
+            collect_wave_refs(((BinaryExpr*)node)->lhs, refs);
+            collect_wave_refs(((BinaryExpr*)node)->rhs, refs);
+            break;
+        }
+        case NodeType::UnaryExpr: {
+            collect_wave_refs(((UnaryExpr*)node)->operand, refs);
+            break;
+        }
+        case NodeType::SharedExprNode: {
+            collect_wave_refs(((SharedExprNode*)node)->shared->expr, refs);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void collect_wave_refs(std::shared_ptr<Wave> wave, std::vector<std::shared_ptr<Wave>>& refs)
+{
+    collect_wave_refs(wave->fast_wave_expr, refs);
+    collect_wave_refs(wave->fast_freq_expr, refs);
+    collect_wave_refs(wave->fast_phase_expr, refs);
+    collect_wave_refs(wave->fast_vol_expr, refs);
+    collect_wave_refs(wave->fast_pan_expr, refs);
+
+    if (wave->processor != nullptr) {
+        refs.insert(refs.end(), wave->processor->inputs.begin(), wave->processor->inputs.end());
+    }
+}
+
+static void replace_wave_refs(Expr* node, std::function<std::shared_ptr<Wave>(std::shared_ptr<Wave>)>& replace)
+{
+    if (node == nullptr) return;
+
+    switch (node->type) {
+        case NodeType::RuntimeValPointerNode: {
+            RuntimeValPointerNode* dnode = (RuntimeValPointerNode*)node;
+            if (dnode->value->type == RuntimeType::Wave) {
+                dnode->value = replace(std::static_pointer_cast<Wave>(dnode->value));
+            }
+            break;
+        }
+        case NodeType::CallExpr: {
+            for (Expr* arg : ((CallExpr*)node)->arguments->arguments) {
+                replace_wave_refs(arg, replace);
+            }
+            break;
+        }
+        case NodeType::MemberExpr: {
+            replace_wave_refs(((MemberExpr*)node)->object, replace);
+            replace_wave_refs(((MemberExpr*)node)->index, replace);
+            break;
+        }
+        case NodeType::BinaryExpr: {
+            replace_wave_refs(((BinaryExpr*)node)->lhs, replace);
+            replace_wave_refs(((BinaryExpr*)node)->rhs, replace);
+            break;
+        }
+        case NodeType::UnaryExpr: {
+            replace_wave_refs(((UnaryExpr*)node)->operand, replace);
+            break;
+        }
+        case NodeType::SharedExprNode: {
+            replace_wave_refs(((SharedExprNode*)node)->shared->expr, replace);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void replace_wave_refs(std::shared_ptr<Wave> wave, std::function<std::shared_ptr<Wave>(std::shared_ptr<Wave>)> replace)
+{
+    replace_wave_refs(wave->fast_wave_expr, replace);
+    replace_wave_refs(wave->fast_freq_expr, replace);
+    replace_wave_refs(wave->fast_phase_expr, replace);
+    replace_wave_refs(wave->fast_vol_expr, replace);
+    replace_wave_refs(wave->fast_pan_expr, replace);
+}
+
+static bool is_pure_expr(Expr* node)
+{
+    switch (node->type) {
+        case NodeType::CallExpr: {
+            CallExpr* dnode = (CallExpr*)node;
+            if (!Azurite::is_pure_builtin(dnode->callee->name)) {
+                return false;
+            }
+            for (Expr* arg : dnode->arguments->arguments) {
+                if (!is_pure_expr(arg)) return false;
+            }
+            return true;
+        }
+        case NodeType::MemberExpr:
+            return is_pure_expr(((MemberExpr*)node)->object) && is_pure_expr(((MemberExpr*)node)->index);
+        case NodeType::BinaryExpr:
+            return is_pure_expr(((BinaryExpr*)node)->lhs) && is_pure_expr(((BinaryExpr*)node)->rhs);
+        case NodeType::UnaryExpr:
+            return is_pure_expr(((UnaryExpr*)node)->operand);
+        case NodeType::SharedExprNode:
+            return is_pure_expr(((SharedExprNode*)node)->shared->expr);
+        default:
+            return true;
+    }
+}
+
+bool is_pure_wave(std::shared_ptr<Wave> wave)
+{
+    if (wave->processor != nullptr && !wave->processor->pure()) {
+        return false;
+    }
+    return is_pure_expr(wave->fast_wave_expr)
+        && is_pure_expr(wave->fast_freq_expr)
+        && is_pure_expr(wave->fast_phase_expr)
+        && is_pure_expr(wave->fast_vol_expr)
+        && is_pure_expr(wave->fast_pan_expr);
+}
+
+static bool calls_function(Expr* node, const std::string& name)
+{
+    switch (node->type) {
+        case NodeType::CallExpr: {
+            CallExpr* dnode = (CallExpr*)node;
+            if (dnode->callee->name == name) {
+                return true;
+            }
+            for (Expr* arg : dnode->arguments->arguments) {
+                if (calls_function(arg, name)) return true;
+            }
+            return false;
+        }
+        case NodeType::MemberExpr:
+            return calls_function(((MemberExpr*)node)->object, name) || calls_function(((MemberExpr*)node)->index, name);
+        case NodeType::BinaryExpr:
+            return calls_function(((BinaryExpr*)node)->lhs, name) || calls_function(((BinaryExpr*)node)->rhs, name);
+        case NodeType::UnaryExpr:
+            return calls_function(((UnaryExpr*)node)->operand, name);
+        case NodeType::SharedExprNode:
+            return calls_function(((SharedExprNode*)node)->shared->expr, name);
+        default:
+            return false;
+    }
+}
+
+bool calls_function(std::shared_ptr<Wave> wave, const std::string& name)
+{
+    return calls_function(wave->fast_wave_expr, name)
+        || calls_function(wave->fast_freq_expr, name)
+        || calls_function(wave->fast_phase_expr, name)
+        || calls_function(wave->fast_vol_expr, name)
+        || calls_function(wave->fast_pan_expr, name);
+}
+
+SharedExprNode::SharedExprNode(std::shared_ptr<SharedValue> shared, Token begin)
+    : Expr(NodeType::SharedExprNode, begin), shared(shared) {}
+
+// Built-ins that are plain functions of their arguments
+static bool is_math_builtin(const std::string& name)
+{
+    return name == "sin" || name == "floor" || name == "abs" || name == "sqrt" || name == "len";
+}
+
+bool is_repeatable(Expr* node)
+{
+    switch (node->type) {
+        case NodeType::CallExpr: {
+            CallExpr* dnode = (CallExpr*)node;
+            if (!is_math_builtin(dnode->callee->name)) {
+                return false;
+            }
+            for (Expr* arg : dnode->arguments->arguments) {
+                if (!is_repeatable(arg)) return false;
+            }
+            return true;
+        }
+        case NodeType::MemberExpr:
+            return is_repeatable(((MemberExpr*)node)->object) && is_repeatable(((MemberExpr*)node)->index);
+        case NodeType::BinaryExpr:
+            return is_repeatable(((BinaryExpr*)node)->lhs) && is_repeatable(((BinaryExpr*)node)->rhs);
+        case NodeType::UnaryExpr:
+            return is_repeatable(((UnaryExpr*)node)->operand);
+        default:
+            return true;
+    }
+}
+
+bool reads_x(Expr* node)
+{
+    switch (node->type) {
+        case NodeType::NumberPointerNode:
+            return true;
+        case NodeType::CallExpr: {
+            for (Expr* arg : ((CallExpr*)node)->arguments->arguments) {
+                if (reads_x(arg)) return true;
+            }
+            return false;
+        }
+        case NodeType::MemberExpr:
+            return reads_x(((MemberExpr*)node)->object) || reads_x(((MemberExpr*)node)->index);
+        case NodeType::BinaryExpr:
+            return reads_x(((BinaryExpr*)node)->lhs) || reads_x(((BinaryExpr*)node)->rhs);
+        case NodeType::UnaryExpr:
+            return reads_x(((UnaryExpr*)node)->operand);
+        case NodeType::SharedExprNode:
+            return reads_x(((SharedExprNode*)node)->shared->expr);
+        default:
+            return false;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Common subexpressions
+
+// x means time in freq, phase and vol but the phase in the waveform, so
+// subtrees reading x only match within the same group
+#define CONTEXT_NONE 0
+#define CONTEXT_WAVEFORM 1
+#define CONTEXT_PARAMS 2
+
+// The slots a wave evaluates per sample, with the meaning of x in each
+static void evaluated_slots(std::shared_ptr<Wave> wave, std::vector<Expr**>& slots, std::vector<int>& contexts)
+{
+    slots = {&wave->fast_wave_expr, &wave->fast_freq_expr, &wave->fast_phase_expr, &wave->fast_vol_expr};
+    contexts = {CONTEXT_WAVEFORM, CONTEXT_PARAMS, CONTEXT_PARAMS, CONTEXT_PARAMS};
+}
+
+static bool is_operation(Expr* node)
+{
+    return node->type == NodeType::BinaryExpr || node->type == NodeType::UnaryExpr
+        || node->type == NodeType::CallExpr || node->type == NodeType::MemberExpr;
+}
+
+static void child_slots(Expr* node, std::vector<Expr**>& children)
+{
+    children.clear();
+    switch (node->type) {
+        case NodeType::BinaryExpr:
+            children.push_back(&((BinaryExpr*)node)->lhs);
+            children.push_back(&((BinaryExpr*)node)->rhs);
+            break;
+        case NodeType::UnaryExpr:
+            children.push_back(&((UnaryExpr*)node)->operand);
+            break;
+        case NodeType::CallExpr:
+            for (Expr*& arg : ((CallExpr*)node)->arguments->arguments) {
+                children.push_back(&arg);
+            }
+            break;
+        case NodeType::MemberExpr:
+            children.push_back(&((MemberExpr*)node)->object);
+            children.push_back(&((MemberExpr*)node)->index);
+            break;
+        default:
+            break;
+    }
+}
+
+static uint64_t hash_subtree(Expr* node, uint64_t hash = AZ_HASH_SEED)
+{
+    hash = hash_value(node->type, hash);
+
+    switch (node->type) {
+        case NodeType::NumericLiteral:
+            return hash_value(((NumericLiteral*)node)->value, hash);
+        case NodeType::StringLiteral:
+            return hash_string(((StringLiteral*)node)->value, hash);
+        case NodeType::RuntimeValPointerNode: {
+            RuntimeValPointerNode* dnode = (RuntimeValPointerNode*)node;
+            if (dnode->value->type == RuntimeType::Number) {
+                return hash_value(std::static_pointer_cast<Number>(dnode->value)->value, hash);
+            }
+            return hash_value(dnode->value.get(), hash);
+        }
+        case NodeType::NumberPointerNode:
+            return hash_value(((NumberPointerNode*)node)->value, hash);
+        case NodeType::SharedExprNode:
+            return hash_value(((SharedExprNode*)node)->shared.get(), hash);
+        case NodeType::BinaryExpr:
+            hash = hash_string(((BinaryExpr*)node)->op.value, hash);
+            break;
+        case NodeType::UnaryExpr:
+            hash = hash_string(((UnaryExpr*)node)->op.value, hash);
+            break;
+        case NodeType::CallExpr:
+            hash = hash_string(((CallExpr*)node)->callee->name, hash);
+            break;
+        default:
+            break;
+    }
+
+    std::vector<Expr**> children;
+    child_slots(node, children);
+    hash = hash_value(children.size(), hash);
+    for (Expr** child : children) {
+        hash = hash_subtree(*child, hash);
+    }
+    return hash;
+}
+
+static bool same_subtree(Expr* a, Expr* b)
+{
+    if (a->type != b->type) {
+        return false;
+    }
+
+    switch (a->type) {
+        case NodeType::NumericLiteral:
+            return ((NumericLiteral*)a)->value == ((NumericLiteral*)b)->value;
+        case NodeType::StringLiteral:
+            return ((StringLiteral*)a)->value == ((StringLiteral*)b)->value;
+        case NodeType::RuntimeValPointerNode: {
+            RuntimeValPtr va = ((RuntimeValPointerNode*)a)->value;
+            RuntimeValPtr vb = ((RuntimeValPointerNode*)b)->value;
+            if (va->type == RuntimeType::Number && vb->type == RuntimeType::Number) {
+                return std::static_pointer_cast<Number>(va)->value == std::static_pointer_cast<Number>(vb)->value;
+            }
+            return va == vb;
+        }
+        case NodeType::NumberPointerNode:
+            return ((NumberPointerNode*)a)->value == ((NumberPointerNode*)b)->value;
+        case NodeType::SharedExprNode:
+            return ((SharedExprNode*)a)->shared == ((SharedExprNode*)b)->shared;
+        case NodeType::BinaryExpr:
+            if (((BinaryExpr*)a)->op.value != ((BinaryExpr*)b)->op.value) return false;
+            break;
+        case NodeType::UnaryExpr:
+            if (((UnaryExpr*)a)->op.value != ((UnaryExpr*)b)->op.value) return false;
+            break;
+        case NodeType::CallExpr:
+            if (((CallExpr*)a)->callee->name != ((CallExpr*)b)->callee->name) return false;
+            break;
+        default:
+            break;
+    }
+
+    std::vector<Expr**> a_children, b_children;
+    child_slots(a, a_children);
+    child_slots(b, b_children);
+    if (a_children.size() != b_children.size()) {
+        return false;
+    }
+    for (int i = 0; i < a_children.size(); i++) {
+        if (!same_subtree(*a_children[i], *b_children[i])) return false;
+    }
+    return true;
+}
+
+static bool reads_wave_or_buffer(Expr* node)
+{
+    if (node->type == NodeType::RuntimeValPointerNode) {
+        RuntimeType type = ((RuntimeValPointerNode*)node)->value->type;
+        return type == RuntimeType::Wave || type == RuntimeType::Buffer;
+    }
+
+    std::vector<Expr**> children;
+    child_slots(node, children);
+    for (Expr** child : children) {
+        if (reads_wave_or_buffer(*child)) return true;
+    }
+    return false;
+}
+
+// Subtrees worth sharing, keyed by hash and the meaning of x in them
+static uint64_t subtree_key(Expr* node, int context)
+{
+    return hash_value(reads_x(node) ? context : CONTEXT_NONE, hash_subtree(node));
+}
+
+static void fold_constants(Expr** slot, std::function<RuntimeValPtr(Expr*)>& evaluate)
+{
+    Expr* node = *slot;
+
+    if (is_operation(node) && is_repeatable(node) && !reads_x(node) && !reads_wave_or_buffer(node)) {
+        *slot = new RuntimeValPointerNode(evaluate(node), node->begin);
+        delete node;
+        return;
+    }
+
+    std::vector<Expr**> children;
+    child_slots(node, children);
+    for (Expr** child : children) {
+        fold_constants(child, evaluate);
+    }
+}
+
+void fold_constant_subexprs(std::shared_ptr<Wave> wave, std::function<RuntimeValPtr(Expr*)> evaluate)
+{
+    if (wave->processor != nullptr) {
+        return;
+    }
+
+    std::vector<Expr**> slots;
+    std::vector<int> contexts;
+    evaluated_slots(wave, slots, contexts);
+    for (Expr** slot : slots) {
+        fold_constants(slot, evaluate);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Across waves
+
+// Waves reachable from wave through its references, including itself if
+// it's on a cycle
+static void reachable_waves(Wave* wave, std::unordered_map<Wave*, std::shared_ptr<Wave>>& by_pointer,
+    std::unordered_set<Wave*>& reached)
+{
+    std::vector<std::shared_ptr<Wave>> refs;
+    collect_wave_refs(by_pointer[wave], refs);
+    for (std::shared_ptr<Wave> ref : refs) {
+        if (!reached.count(ref.get())) {
+            reached.insert(ref.get());
+            by_pointer[ref.get()] = ref;
+            reachable_waves(ref.get(), by_pointer, reached);
+        }
+    }
+}
+
+static bool hoistable(Expr* node)
+{
+    return is_operation(node) && node->type != NodeType::MemberExpr
+        && !reads_x(node) && is_repeatable(node) && reads_wave_or_buffer(node);
+}
+
+static void count_hoistable(Expr* node, Wave* wave, std::unordered_map<uint64_t, std::unordered_set<Wave*>>& users)
+{
+    if (hoistable(node)) {
+        users[subtree_key(node, CONTEXT_NONE)].insert(wave);
+    }
+
+    std::vector<Expr**> children;
+    child_slots(node, children);
+    for (Expr** child : children) {
+        count_hoistable(*child, wave, users);
+    }
+}
+
+// A wave rendering an already simplified expression on its own
+static std::shared_ptr<Wave> make_subexpr_wave(Expr* expr)
+{
+    std::shared_ptr<Wave> wave = std::make_shared<Wave>(expr);
+    wave->block.assign(BLOCK_SIZE, 0.0);
+    return wave;
+}
+
+struct HoistState {
+    std::unordered_map<uint64_t, std::unordered_set<Wave*>> users;
+    std::unordered_map<Wave*, std::unordered_set<Wave*>> reach;
+    std::unordered_map<uint64_t, std::vector<std::shared_ptr<Wave>>> hoisted;
+    std::vector<std::shared_ptr<Wave>> added;
+};
+
+// True if every wave the subtree reads renders before wave without going
+// through feedback
+static bool reads_ahead_only(Expr* node, Wave* wave, HoistState& state)
+{
+    std::vector<std::shared_ptr<Wave>> refs;
+    collect_wave_refs(node, refs);
+    for (std::shared_ptr<Wave> ref : refs) {
+        std::unordered_set<Wave*>& reached = state.reach[ref.get()];
+        if (ref.get() == wave || reached.count(wave) || reached.count(ref.get())) {
+            return false;
+        }
+        for (Wave* other : reached) {
+            if (state.reach[other].count(other)) return false;
+        }
+    }
+    return true;
+}
+
+static void hoist_subtrees(Expr** slot, Wave* wave, HoistState& state)
+{
+    Expr* node = *slot;
+
+    if (hoistable(node)) {
+        uint64_t key = subtree_key(node, CONTEXT_NONE);
+        if (state.users[key].size() > 1 && reads_ahead_only(node, wave, state)) {
+            std::shared_ptr<Wave> source = nullptr;
+            for (std::shared_ptr<Wave> candidate : state.hoisted[key]) {
+                if (same_subtree(candidate->fast_wave_expr, node)) {
+                    source = candidate;
+                    break;
+                }
+            }
+
+            Token begin = node->begin;
+            if (source == nullptr) {
+                source = make_subexpr_wave(node);
+                state.hoisted[key].push_back(source);
+                state.added.push_back(source);
+            } else {
+                delete node;
+            }
+
+            *slot = new RuntimeValPointerNode(source, begin);
+            return;
+        }
+    }
+
+    std::vector<Expr**> children;
+    child_slots(node, children);
+    for (Expr** child : children) {
+        hoist_subtrees(child, wave, state);
+    }
+}
+
+void hoist_common_subexprs(std::vector<std::shared_ptr<Wave>>& graph)
+{
+    HoistState state;
+    std::unordered_map<Wave*, std::shared_ptr<Wave>> by_pointer;
+    std::vector<Expr**> slots;
+    std::vector<int> contexts;
+
+    // Oversampled waves read other waves between samples, which a shared
+    // block can't stand in for
+    std::vector<std::shared_ptr<Wave>> candidates;
+    for (std::shared_ptr<Wave> wave : graph) {
+        by_pointer[wave.get()] = wave;
+        if (wave->processor == nullptr && wave->decimator == nullptr) {
+            candidates.push_back(wave);
+        }
+    }
+
+    for (std::shared_ptr<Wave> wave : candidates) {
+        evaluated_slots(wave, slots, contexts);
+        for (Expr** slot : slots) {
+            count_hoistable(*slot, wave.get(), state.users);
+        }
+    }
+
+    bool shared = false;
+    for (std::pair<const uint64_t, std::unordered_set<Wave*>>& entry : state.users) {
+        shared |= entry.second.size() > 1;
+    }
+    if (!shared) {
+        return;
+    }
+
+    for (std::shared_ptr<Wave> wave : graph) {
+        reachable_waves(wave.get(), by_pointer, state.reach[wave.get()]);
+    }
+
+    for (std::shared_ptr<Wave> wave : candidates) {
+        evaluated_slots(wave, slots, contexts);
+        for (Expr** slot : slots) {
+            hoist_subtrees(slot, wave.get(), state);
+        }
+    }
+
+    graph.insert(graph.end(), state.added.begin(), state.added.end());
+}
+
+// ---------------------------------------------------------------------------
+// Within a wave
+
+static void count_shareable(Expr* node, int context, std::unordered_map<uint64_t, int>& counts)
+{
+    if (is_operation(node) && is_repeatable(node)) {
+        counts[subtree_key(node, context)]++;
+    }
+
+    std::vector<Expr**> children;
+    child_slots(node, children);
+    for (Expr** child : children) {
+        count_shareable(*child, context, counts);
+    }
+}
+
+static void share_subtrees(Expr** slot, int context, std::unordered_map<uint64_t, int>& counts,
+    std::unordered_map<uint64_t, std::vector<std::shared_ptr<SharedValue>>>& shared)
+{
+    Expr* node = *slot;
+
+    if (is_operation(node) && is_repeatable(node)) {
+        uint64_t key = subtree_key(node, context);
+        if (counts[key] > 1) {
+            for (std::shared_ptr<SharedValue> value : shared[key]) {
+                if (same_subtree(value->expr, node)) {
+                    *slot = new SharedExprNode(value, node->begin);
+                    delete node;
+                    return;
+                }
+            }
+
+            // First occurrence: it becomes the shared expr, with anything
+            // shared inside it handled in place
+            std::shared_ptr<SharedValue> value = std::make_shared<SharedValue>(node);
+            shared[key].push_back(value);
+            *slot = new SharedExprNode(value, node->begin);
+
+            std::vector<Expr**> children;
+            child_slots(node, children);
+            for (Expr** child : children) {
+                share_subtrees(child, context, counts, shared);
+            }
+            return;
+        }
+    }
+
+    std::vector<Expr**> children;
+    child_slots(node, children);
+    for (Expr** child : children) {
+        share_subtrees(child, context, counts, shared);
+    }
+}
+
+void share_common_subexprs(std::shared_ptr<Wave> wave)
+{
+    if (wave->processor != nullptr) {
+        return;
+    }
+
+    std::vector<Expr**> slots;
+    std::vector<int> contexts;
+    evaluated_slots(wave, slots, contexts);
+
+    std::unordered_map<uint64_t, int> counts;
+    for (int i = 0; i < slots.size(); i++) {
+        count_shareable(*slots[i], contexts[i], counts);
+    }
+
+    std::unordered_map<uint64_t, std::vector<std::shared_ptr<SharedValue>>> shared;
+    for (int i = 0; i < slots.size(); i++) {
+        share_subtrees(slots[i], contexts[i], counts, shared);
+    }
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include "ast.h"
 #include "token.h"
@@ -23,4 +25,64 @@ public:
 
     NumberPointerNode(double* value, Token begin);
     ~NumberPointerNode() {}
-};
\ No newline at end of file
+};
+
+
+// The value of a subtree that appears more than once in a wave's simplified
+// exprs, computed once per sample point and then reused
+struct SharedValue {
+    Expr* expr;
+    std::shared_ptr<RuntimeVal> value;
+    long stamp;
+
+    SharedValue(Expr* expr) : expr(expr), stamp(-1) {}
+    ~SharedValue() { delete expr; }
+};
+
+// Stands in for each occurrence of a shared subtree
+class SharedExprNode : public Expr
+{
+public:
+    std::shared_ptr<SharedValue> shared;
+
+    SharedExprNode(std::shared_ptr<SharedValue> shared, Token begin);
+    ~SharedExprNode() {}
+};
+
+
+// Waves referenced by the simplified (fast_*) expressions of a wave
+void collect_wave_refs(Expr* node, std::vector<std::shared_ptr<Wave>>& refs);
+void collect_wave_refs(std::shared_ptr<Wave> wave, std::vector<std::shared_ptr<Wave>>& refs);
+// Points the simplified expressions of a wave at replace(ref) instead of
+// each wave they reference
+void replace_wave_refs(std::shared_ptr<Wave> wave, std::function<std::shared_ptr<Wave>(std::shared_ptr<Wave>)> replace);
+
+// True if a simplified wave only calls pure built-ins, so it can be
+// evaluated on any thread without touching interpreter scopes
+bool is_pure_wave(std::shared_ptr<Wave> wave);
+
+// True if any simplified expression of the wave calls the named function
+bool calls_function(std::shared_ptr<Wave> wave, const std::string& name);
+
+// True if node always gives the same value for the same x and wave samples
+// (no rnd, print or script functions), so it can be computed once and reused
+bool is_repeatable(Expr* node);
+// True if node reads the wave's x (a NumberPointerNode)
+bool reads_x(Expr* node);
+
+// Replaces subtrees that don't read x, waves or buffers with their value,
+// worked out once with evaluate
+void fold_constant_subexprs(std::shared_ptr<Wave> wave, std::function<std::shared_ptr<RuntimeVal>(Expr*)> evaluate);
+
+// Common subexpression elimination over the simplified exprs waves
+// evaluate per sample (not pan, which isn't evaluated yet).
+//
+// Subtrees that don't depend on x and appear in more than one wave of the
+// graph are moved into a new wave of their own, rendered once per block and
+// read by the others. Waves reading each other through feedback are left
+// out, since that could move the one block delay. The new waves are added
+// to graph, already prepared.
+void hoist_common_subexprs(std::vector<std::shared_ptr<Wave>>& graph);
+// Subtrees appearing more than once within a wave are replaced by
+// SharedExprNodes
+void share_common_subexprs(std::shared_ptr<Wave> wave);
@@ -0,0 +1,80 @@
+#include "fft.h"
+
+#include <cmath>
+
+FFT::FFT(int size)
+    : n(size)
+{
+    twiddles.resize(n / 2);
+    for (int i = 0; i < n / 2; i++) {
+        double angle = -2.0 * M_PI * i / n;
+        twiddles[i] = Complex(std::cos(angle), std::sin(angle));
+    }
+
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+
+    reversed.resize(n);
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+        }
+        reversed[i] = r;
+    }
+}
+
+int FFT::size()
+{
+    return n;
+}
+
+void FFT::forward(std::vector<Complex>& data)
+{
+    transform(data, false);
+}
+
+void FFT::inverse(std::vector<Complex>& data)
+{
+    transform(data, true);
+
+    double scale = 1.0 / n;
+    for (int i = 0; i < n; i++) {
+        data[i] *= scale;
+    }
+}
+
+void FFT::transform(std::vector<Complex>& data, bool invert)
+{
+    for (int i = 0; i < n; i++) {
+        if (i < reversed[i]) {
+            std::swap(data[i], data[reversed[i]]);
+        }
+    }
+
+    // Butterflies of growing span. The twiddle for span len is every
+    // (n / len)th entry of the table for the full size.
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len / 2;
+        int stride = n / len;
+
+        for (int start = 0; start < n; start += len) {
+            for (int k = 0; k < half; k++) {
+                Complex w = twiddles[k * stride];
+                if (invert) w = std::conj(w);
+
+                Complex even = data[start + k];
+                Complex odd = data[start + k + half] * w;
+                data[start + k] = even + odd;
+                data[start + k + half] = even - odd;
+            }
+        }
+    }
+}
+
+int next_pow2(int n)
+{
+    int p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> Complex;
+
+// In-place iterative radix-2 FFT. Twiddles and the bit reversal table are
+// computed once per size, so keep an FFT around rather than making one per
+// transform.
+class FFT
+{
+public:
+    // size must be a power of two
+    FFT(int size);
+    ~FFT() {}
+
+    int size();
+
+    void forward(std::vector<Complex>& data);
+    // Scaled by 1/size, so inverse(forward(x)) == x
+    void inverse(std::vector<Complex>& data);
+
+private:
+    int n;
+    std::vector<Complex> twiddles;
+    std::vector<int> reversed;
+
+    void transform(std::vector<Complex>& data, bool invert);
+};
+
+// Smallest power of two >= n
+int next_pow2(int n);
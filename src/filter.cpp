@@ -0,0 +1,206 @@
+#include "filter.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Keep the maths away from 0 Hz, Nyquist and zero resonance
+static double clamp_cutoff(double cutoff)
+{
+    return std::min(std::max(cutoff, 10.0), SAMPLE_RATE * 0.49);
+}
+
+static double clamp_q(double q)
+{
+    return std::max(q, 0.05);
+}
+
+FilterProcessor::FilterProcessor(std::shared_ptr<Wave> input, FilterType filter_type, ProcessorParam cutoff, ProcessorParam q)
+    : filter_type(filter_type), cutoff(cutoff), q(q), primed(false)
+{
+    inputs.push_back(input);
+    add_param(this->cutoff);
+    add_param(this->q);
+}
+
+void FilterProcessor::reset()
+{
+    clear_state();
+    std::fill(step, step + FILTER_COEFFS, 0.0);
+    primed = false;
+}
+
+void FilterProcessor::replace_input(Wave* input, std::shared_ptr<Wave> replacement)
+{
+    WaveProcessor::replace_input(input, replacement);
+    if (cutoff.wave.get() == input) {
+        cutoff.wave = replacement;
+    }
+    if (q.wave.get() == input) {
+        q.wave = replacement;
+    }
+}
+
+void FilterProcessor::process(std::vector<double>& out, int start, int count)
+{
+    const double* in = inputs[0]->block.data();
+    bool modulated = cutoff.modulated() || q.modulated();
+
+    if (!primed) {
+        compute(clamp_cutoff(cutoff.at(0)), clamp_q(q.at(0)), coeffs);
+        primed = true;
+    }
+
+    if (!modulated) {
+        run(in, out.data(), count);
+        return;
+    }
+
+    double target[FILTER_COEFFS];
+    for (int i = 0; i < count; i += CONTROL_INTERVAL) {
+        int n = std::min(CONTROL_INTERVAL, count - i);
+
+        // Ramp towards the coefficients for the end of this stretch
+        compute(clamp_cutoff(cutoff.at(i + n - 1)), clamp_q(q.at(i + n - 1)), target);
+        for (int c = 0; c < FILTER_COEFFS; c++) {
+            step[c] = (target[c] - coeffs[c]) / n;
+        }
+
+        run(in + i, out.data() + i, n);
+
+        // Land exactly on the target so rounding doesn't build up
+        std::copy(target, target + FILTER_COEFFS, coeffs);
+    }
+}
+
+bool FilterProcessor::hash(uint64_t& hash)
+{
+    hash = hash_string(name(), hash);
+    hash = hash_value(filter_type, hash);
+    cutoff.hash(hash);
+    q.hash(hash);
+    return true;
+}
+
+BiquadProcessor::BiquadProcessor(std::shared_ptr<Wave> input, FilterType filter_type, ProcessorParam cutoff, ProcessorParam q)
+    : FilterProcessor(input, filter_type, cutoff, q), z1(0.0), z2(0.0) {}
+
+void BiquadProcessor::compute(double cutoff, double q, double* coeffs)
+{
+    double w0 = 2.0 * M_PI * cutoff / SAMPLE_RATE;
+    double cos_w0 = std::cos(w0);
+    double alpha = std::sin(w0) / (2.0 * q);
+
+    double b0, b1, b2;
+    switch (filter_type) {
+        case FilterType::Lowpass:
+            b0 = (1.0 - cos_w0) / 2.0;
+            b1 = 1.0 - cos_w0;
+            b2 = b0;
+            break;
+        case FilterType::Highpass:
+            b0 = (1.0 + cos_w0) / 2.0;
+            b1 = -(1.0 + cos_w0);
+            b2 = b0;
+            break;
+        case FilterType::Bandpass:
+            b0 = alpha;
+            b1 = 0.0;
+            b2 = -alpha;
+            break;
+        case FilterType::Notch:
+        default:
+            b0 = 1.0;
+            b1 = -2.0 * cos_w0;
+            b2 = 1.0;
+            break;
+    }
+
+    double a0 = 1.0 + alpha;
+    coeffs[0] = b0 / a0;
+    coeffs[1] = b1 / a0;
+    coeffs[2] = b2 / a0;
+    coeffs[3] = -2.0 * cos_w0 / a0;
+    coeffs[4] = (1.0 - alpha) / a0;
+}
+
+void BiquadProcessor::clear_state()
+{
+    z1 = 0.0;
+    z2 = 0.0;
+}
+
+void BiquadProcessor::run(const double* in, double* out, int count)
+{
+    double b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2], a1 = coeffs[3], a2 = coeffs[4];
+
+    for (int i = 0; i < count; i++) {
+        double x = in[i];
+        double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        out[i] = y;
+
+        b0 += step[0];
+        b1 += step[1];
+        b2 += step[2];
+        a1 += step[3];
+        a2 += step[4];
+    }
+}
+
+SvfProcessor::SvfProcessor(std::shared_ptr<Wave> input, FilterType filter_type, ProcessorParam cutoff, ProcessorParam q)
+    : FilterProcessor(input, filter_type, cutoff, q), ic1eq(0.0), ic2eq(0.0) {}
+
+void SvfProcessor::compute(double cutoff, double q, double* coeffs)
+{
+    double g = std::tan(M_PI * cutoff / SAMPLE_RATE);
+    double k = 1.0 / q;
+    double a1 = 1.0 / (1.0 + g * (g + k));
+
+    coeffs[0] = a1;
+    coeffs[1] = g * a1;
+    coeffs[2] = g * g * a1;
+    coeffs[3] = k;
+    coeffs[4] = 0.0;
+}
+
+void SvfProcessor::clear_state()
+{
+    ic1eq = 0.0;
+    ic2eq = 0.0;
+}
+
+void SvfProcessor::run(const double* in, double* out, int count)
+{
+    double a1 = coeffs[0], a2 = coeffs[1], a3 = coeffs[2], k = coeffs[3];
+
+    for (int i = 0; i < count; i++) {
+        double v0 = in[i];
+        double v3 = v0 - ic2eq;
+        double v1 = a1 * ic1eq + a2 * v3;
+        double v2 = ic2eq + a2 * ic1eq + a3 * v3;
+        ic1eq = 2.0 * v1 - ic1eq;
+        ic2eq = 2.0 * v2 - ic2eq;
+
+        switch (filter_type) {
+            case FilterType::Lowpass:
+                out[i] = v2;
+                break;
+            case FilterType::Highpass:
+                out[i] = v0 - k * v1 - v2;
+                break;
+            case FilterType::Bandpass:
+                out[i] = v1;
+                break;
+            case FilterType::Notch:
+                out[i] = v0 - k * v1;
+                break;
+        }
+
+        a1 += step[0];
+        a2 += step[1];
+        a3 += step[2];
+        k += step[3];
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "processor.h"
+
+// Samples between coefficient updates. Coefficients are interpolated
+// linearly in between, which keeps sweeps smooth without recomputing the
+// trig per sample.
+#define CONTROL_INTERVAL 16
+
+#define FILTER_COEFFS 5
+
+enum class FilterType
+{
+    Lowpass,
+    Highpass,
+    Bandpass,
+    Notch
+};
+
+
+// Resonant filter with a cutoff and Q that can be modulated by waves.
+// Subclasses provide the coefficients and the per-sample recurrence.
+class FilterProcessor : public WaveProcessor
+{
+public:
+    FilterProcessor(std::shared_ptr<Wave> input, FilterType filter_type, ProcessorParam cutoff, ProcessorParam q);
+    virtual ~FilterProcessor() {}
+
+    void reset();
+    void process(std::vector<double>& out, int start, int count);
+    bool hash(uint64_t& hash);
+    void replace_input(Wave* input, std::shared_ptr<Wave> replacement);
+
+protected:
+    FilterType filter_type;
+    ProcessorParam cutoff;
+    ProcessorParam q;
+
+    double coeffs[FILTER_COEFFS];
+    double step[FILTER_COEFFS];
+    bool primed;
+
+    virtual const char* name() = 0;
+    virtual void compute(double cutoff, double q, double* coeffs) = 0;
+    virtual void clear_state() = 0;
+    // Filter count samples, adding step to coeffs after each one
+    virtual void run(const double* in, double* out, int count) = 0;
+};
+
+
+// RBJ cookbook biquad in transposed direct form II
+class BiquadProcessor : public FilterProcessor
+{
+public:
+    BiquadProcessor(std::shared_ptr<Wave> input, FilterType filter_type, ProcessorParam cutoff, ProcessorParam q);
+    ~BiquadProcessor() {}
+
+protected:
+    const char* name() { return "biquad"; }
+    void compute(double cutoff, double q, double* coeffs);
+    void clear_state();
+    void run(const double* in, double* out, int count);
+
+private:
+    double z1, z2;
+};
+
+
+// Trapezoidal state variable filter (Simper). Stays stable under fast
+// modulation, where a biquad can blow up.
+class SvfProcessor : public FilterProcessor
+{
+public:
+    SvfProcessor(std::shared_ptr<Wave> input, FilterType filter_type, ProcessorParam cutoff, ProcessorParam q);
+    ~SvfProcessor() {}
+
+protected:
+    const char* name() { return "svf"; }
+    void compute(double cutoff, double q, double* coeffs);
+    void clear_state();
+    void run(const double* in, double* out, int count);
+
+private:
+    double ic1eq, ic2eq;
+};
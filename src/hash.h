@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// FNV-1a, used for cache keys. Not for anything security related.
+#define AZ_HASH_SEED 14695981039346656037ULL
+
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = AZ_HASH_SEED)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <class T>
+inline uint64_t hash_value(const T& value, uint64_t hash)
+{
+    return hash_bytes(&value, sizeof(value), hash);
+}
+
+inline uint64_t hash_string(const std::string& value, uint64_t hash)
+{
+    hash = hash_value(value.size(), hash);
+    return hash_bytes(value.data(), value.size(), hash);
+}
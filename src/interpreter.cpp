@@ -1,10 +1,45 @@
 #include "interpreter.h"
+#include "processor.h"
+#include "dsp.h"
+#include "oscillator.h"
+#include "sequencer.h"
+#include "envelope.h"
+#include "activity.h"
+#include "wavereader.h"
+#include "stats.h"
+
+#include <map>
 
 #define PI 3.14159265358979323846
 #define TAU 6.28318530717958647692
 
+// Position within the current block of the wave being evaluated. Waves
+// referenced from its expressions are read from their blocks at this offset.
+static thread_local int block_offset = 0;
+// Offset in samples (-1, 0] of the point being evaluated within the current
+// sample. Only oversampled waves evaluate anywhere but on the sample.
+static thread_local double sub_sample = 0.0;
+// Bumped for every point evaluated, so shared subexpressions know when
+// their value is stale
+static thread_local long eval_stamp = 0;
+// Global position of the last sample in the block being rendered, where
+// control-rate slots put their last control point
+static thread_local int block_end = 0;
+
+static bool is_file_bus(const std::string& name)
+{
+    return name.size() > 4 && name.compare(name.size() - 4, 4, ".wav") == 0;
+}
+
 Interpreter::Interpreter()
+    : program(nullptr), owns_program(false), render_cache(&own_render_cache), captured(nullptr), voices(nullptr),
+    dry_run(false), print_muted(false), filter_buses(false),
+    num_threads(1), default_oversample(1), pool(nullptr), written(0)
 {
+    // A script that failed mid-render on this thread may have left these set
+    block_offset = 0;
+    sub_sample = 0.0;
+
     Azurite::initialize_runtimelib();
     global_scope = new Environment();
     scopes.push_back(global_scope);
@@ -12,11 +47,178 @@ Interpreter::Interpreter()
 
 Interpreter::~Interpreter()
 {
+    delete pool;
+    // Scopes left open by a script that stopped with an error
+    for (int i = 1; i < scopes.size(); i++) {
+        delete scopes[i];
+    }
     delete global_scope;
     for (std::unordered_map<std::string, WaveBuffer*>::iterator it = wave_buffers.begin();
             it != wave_buffers.end(); it++) {
         delete it->second;
     }
+    // Waves in the scopes point into the program, so it goes last
+    if (owns_program) {
+        delete program;
+    }
+}
+
+void Interpreter::set_threads(int num_threads_)
+{
+    num_threads = std::max(1, num_threads_);
+    delete pool;
+    pool = nullptr;
+}
+
+void Interpreter::set_oversample(int factor)
+{
+    default_oversample = factor;
+}
+
+bool Interpreter::valid_oversample(int factor)
+{
+    return factor == 1 || factor == 2 || factor == 4 || factor == 8;
+}
+
+long Interpreter::samples_written()
+{
+    return written;
+}
+
+void Interpreter::capture_output(std::vector<RenderedBus>* out)
+{
+    captured = out;
+}
+
+void Interpreter::set_render_cache(RenderCache* cache)
+{
+    render_cache = cache != nullptr ? cache : &own_render_cache;
+}
+
+void Interpreter::set_dry_run(bool dry_run_)
+{
+    dry_run = dry_run_;
+}
+
+void Interpreter::mute_print(bool mute)
+{
+    print_muted = mute;
+}
+
+std::vector<std::string> Interpreter::output_buses()
+{
+    std::vector<std::string> outputs;
+    for (std::unordered_map<std::string, WaveBuffer*>::iterator it = wave_buffers.begin();
+            it != wave_buffers.end(); it++) {
+        if (is_file_bus(it->first)) {
+            outputs.push_back(it->first);
+        }
+    }
+    std::sort(outputs.begin(), outputs.end());
+    return outputs;
+}
+
+bool Interpreter::output_hash(const std::string& bus, uint64_t& hash)
+{
+    std::unordered_set<std::string> visiting;
+    return hash_bus(bus, hash, visiting);
+}
+
+// A bus hashes its own writes plus, in route order, the buses routed into it
+bool Interpreter::hash_bus(const std::string& name, uint64_t& hash, std::unordered_set<std::string>& visiting)
+{
+    if (unhashable_buses.count(name) || visiting.count(name)) {
+        return false;
+    }
+    visiting.insert(name);
+
+    hash = bus_hashes.count(name) ? bus_hashes[name] : AZ_HASH_SEED;
+    for (BusRoute& route : bus_routes) {
+        if (route.to != name) {
+            continue;
+        }
+        uint64_t from_hash;
+        if (!hash_bus(route.from, from_hash, visiting)) {
+            return false;
+        }
+        hash = hash_value(from_hash, hash);
+        hash = hash_value(route.gain, hash);
+    }
+
+    visiting.erase(name);
+    return true;
+}
+
+std::unordered_set<std::string> Interpreter::buses_feeding(const std::vector<std::string>& outputs)
+{
+    std::unordered_set<std::string> feeding(outputs.begin(), outputs.end());
+    std::vector<std::string> work(outputs.begin(), outputs.end());
+
+    while (!work.empty()) {
+        std::string name = work.back();
+        work.pop_back();
+        for (BusRoute& route : bus_routes) {
+            if (route.to == name && !feeding.count(route.from)) {
+                feeding.insert(route.from);
+                work.push_back(route.from);
+            }
+        }
+    }
+    return feeding;
+}
+
+void Interpreter::render_only(const std::unordered_set<std::string>& buses)
+{
+    filter_buses = true;
+    render_buses = buses;
+}
+
+void Interpreter::collect_voices(std::vector<LiveVoice>* out)
+{
+    voices = out;
+}
+
+void Interpreter::start_voices(std::vector<LiveVoice>& voices, int position)
+{
+    // Preparing voices one by one would reset and re-simplify the waves
+    // they share out from under the voices prepared before
+    std::vector<std::shared_ptr<Wave>> roots;
+    for (LiveVoice& voice : voices) {
+        roots.push_back(voice.wave);
+    }
+    std::vector<std::shared_ptr<Wave>> graph;
+    prepare_wave_graph(roots, graph);
+
+    // Counted as if the waves had been playing all along, so x lines up
+    for (std::shared_ptr<Wave> wave : graph) {
+        wave->sample = position;
+    }
+
+    for (LiveVoice& voice : voices) {
+        voice.dag = std::make_shared<WaveGraph>(voice.wave);
+        voice.graph = voice.dag->nodes;
+    }
+}
+
+void Interpreter::render_voice(LiveVoice& voice, int start, int count)
+{
+    for (std::shared_ptr<Wave> node : voice.dag->nodes) {
+        if (node->rendered_start != start) {
+            render_block(node, start, count);
+            node->rendered_start = start;
+        }
+    }
+}
+
+std::string Interpreter::global_name(std::shared_ptr<Wave> wave)
+{
+    for (std::unordered_map<std::string, RuntimeValPtr>::iterator it = global_scope->var_map.begin();
+            it != global_scope->var_map.end(); it++) {
+        if (it->second.get() == wave.get()) {
+            return it->first;
+        }
+    }
+    return "";
 }
 
 RuntimeValPtr Interpreter::get_var(std::string name) {
@@ -26,8 +228,7 @@ RuntimeValPtr Interpreter::get_var(std::string name) {
             return (*it)->get_var(name);
         }
     }
-    std::cout << "Undeclared variable " << name << std::endl;
-    exit(1);
+    script_error("Undeclared variable " + name);
 }
 
 FunctionDeclaration* Interpreter::get_func(std::string name) {
@@ -36,8 +237,7 @@ FunctionDeclaration* Interpreter::get_func(std::string name) {
             return (*it)->get_func(name);
         }
     }
-    std::cout << "Undeclared function " << name << std::endl;
-    exit(1);
+    script_error("Undeclared function " + name);
 }
 
 void Interpreter::create_var(std::string name, RuntimeValPtr value)
@@ -59,7 +259,6 @@ void Interpreter::create_func(std::string name, FunctionDeclaration* func)
     // Try to reassign existing function first
     for (std::vector<Environment*>::reverse_iterator it = scopes.rbegin(); it != scopes.rend(); it++) {
         if ((*it)->func_map.count(name)) {
-            delete (*it)->func_map[name];
             (*it)->create_func(name, func);
             return;
         }
@@ -85,18 +284,146 @@ void Interpreter::exit_scope()
     //std::cout << scopes.size() << std::endl;
 }
 
-void Interpreter::interpret(std::string source)
+void Interpreter::interpret(std::string source, std::string cache_path)
 {
-    program = parser.parse(source);
+    if (!cache_path.empty()) {
+        uint64_t key = program_cache_key(source);
+        {
+            Azurite::Stats::PhaseTimer timer(StatsPhase::Parse);
+            program = load_program_cache(cache_path, key);
+        }
+        if (program == nullptr) {
+            program = parser.parse(source);
+            save_program_cache(cache_path, key, program);
+        }
+    } else {
+        program = parser.parse(source);
+    }
+    owns_program = true;
+
+    run_program();
+}
+
+void Interpreter::interpret_program(Program* program_)
+{
+    program = program_;
+    owns_program = false;
+
+    run_program();
+}
+
+void Interpreter::run_program()
+{
+#if AZ_LOG_ENABLED
+    if (Azurite::Log::enabled(LogLevel::Debug, LogCategory::Parser)) {
+        printAST(program);
+    }
+#endif
+
+    AZ_LOG(Debug, Interpreter, "bouta interpret");
+    {
+        Azurite::Stats::PhaseTimer timer(StatsPhase::Execute);
+        evaluate_stmt(program->body);
+    }
+
+    Azurite::Stats::PhaseTimer timer(StatsPhase::Write);
+    mix_down_buses();
+}
 
-    printAST(program);
+WaveBuffer* Interpreter::get_bus(std::string name)
+{
+    if (!wave_buffers.count(name)) {
+        wave_buffers[name] = new WaveBuffer();
+    }
+    return wave_buffers[name];
+}
 
-    std::cout << "=======================\nbouta interpret\n";
-    evaluate_stmt(program->body);
+// Buses are finished in dependency order: a bus is streamed out (through
+// its limiter) into the buses it's routed to only once everything routed
+// into it has arrived. .wav buses are then written out.
+void Interpreter::mix_down_buses()
+{
+    // Nothing was rendered into the buses
+    if (voices != nullptr || dry_run) {
+        return;
+    }
 
+    std::unordered_map<std::string, int> incoming;
     for (std::unordered_map<std::string, WaveBuffer*>::iterator it = wave_buffers.begin();
             it != wave_buffers.end(); it++) {
-        write_wave_file(it->first, it->second, 1);
+        incoming[it->first] = 0;
+    }
+    for (BusRoute& route : bus_routes) {
+        incoming[route.to]++;
+    }
+
+    std::vector<std::string> ready;
+    for (std::unordered_map<std::string, int>::iterator it = incoming.begin(); it != incoming.end(); it++) {
+        if (it->second == 0) {
+            ready.push_back(it->first);
+        }
+    }
+    // Deterministic order for buses that become ready together
+    std::sort(ready.begin(), ready.end());
+
+    int finished = 0;
+    while (!ready.empty()) {
+        std::string name = ready.back();
+        ready.pop_back();
+        finished++;
+
+        WaveBuffer* bus = wave_buffers[name];
+        // Buses not feeding any output being rendered are left empty
+        bool skipped = filter_buses && !render_buses.count(name);
+
+        for (BusRoute& route : bus_routes) {
+            if (route.from != name) {
+                continue;
+            }
+            if (skipped) {
+                if (--incoming[route.to] == 0) {
+                    ready.push_back(route.to);
+                }
+                continue;
+            }
+
+            WaveBuffer* target = wave_buffers[route.to];
+            if (bus->length > target->length) {
+                target->length = bus->length;
+            }
+            target->reserve(target->length);
+
+            int pos = 0;
+            stream_wave_buffer(bus, [&](const float* samples, int count) {
+                mix_add(target->data.data() + pos, samples, count, route.gain);
+                pos += count;
+            });
+
+            if (--incoming[route.to] == 0) {
+                ready.push_back(route.to);
+            }
+        }
+
+        if (skipped) {
+            continue;
+        }
+
+        if (is_file_bus(name) && captured != nullptr) {
+            captured->push_back(RenderedBus{name, std::vector<float>()});
+            std::vector<float>& samples = captured->back().samples;
+            samples.reserve(bus->length);
+            stream_wave_buffer(bus, [&](const float* chunk, int count) {
+                samples.insert(samples.end(), chunk, chunk + count);
+            });
+            written += bus->length;
+        } else if (is_file_bus(name)) {
+            write_wave_file(name, bus, 1);
+            written += bus->length;
+        }
+    }
+
+    if (finished < incoming.size()) {
+        std::cout << "Bus routing has a cycle, some buses were not written.\n";
     }
 }
 
@@ -139,7 +466,12 @@ RuntimeValPtr Interpreter::evaluate_stmt(Stmt* node)
         }
         case NodeType::CallExpr: {
             //std::cout << "bouta evaluate CallExpr\n";
-            evaluate_callexpr((CallExpr*)(node));
+            CallExpr* call = (CallExpr*)(node);
+            if (call->tail_call) {
+                return_val = evaluate_tailcall(call, true);
+            } else {
+                evaluate_callexpr(call);
+            }
             break;
         }
         case NodeType::BinaryExpr: {
@@ -191,11 +523,7 @@ void Interpreter::interpret_assignstmt(AssignStmt* node)
         create_var(lhs_id->name, evaluate_expr(node->rhs));
     } else if (node->lhs->type == NodeType::MemberExpr) {
         MemberExpr* lhs_member = (MemberExpr*)(node->lhs);
-        // Get double pointer to element indexed
-        RuntimeValPtr* object = evaluate_memberexpr(lhs_member);
-        // TODO FIX THIS WITH SHARED_PTRs -- I think this works now
-        // reallocate new value in same element of vector
-        *object = evaluate_expr(node->rhs);
+        assign_memberexpr(lhs_member, evaluate_expr(node->rhs));
     }
 }
 
@@ -257,6 +585,9 @@ RuntimeValPtr Interpreter::evaluate_forstmt(ForStmt* node)
 
 RuntimeValPtr Interpreter::evaluate_returnstmt(ReturnStmt* node)
 {
+    if (node->return_expr->type == NodeType::CallExpr && ((CallExpr*)(node->return_expr))->tail_call) {
+        return evaluate_tailcall((CallExpr*)(node->return_expr), false);
+    }
     return evaluate_expr(node->return_expr);
 }
 
@@ -285,6 +616,14 @@ RuntimeValPtr Interpreter::evaluate_expr(Expr* node)
             return evaluate_numberpointernode((NumberPointerNode*)(node));
             break;
         }
+        case NodeType::SharedExprNode: {
+            SharedValue* shared = ((SharedExprNode*)node)->shared.get();
+            if (shared->stamp != eval_stamp) {
+                shared->value = evaluate_expr(shared->expr);
+                shared->stamp = eval_stamp;
+            }
+            return shared->value;
+        }
         case NodeType::CallExpr: {
             RuntimeValPtr return_val = evaluate_callexpr((CallExpr*)(node));
 
@@ -296,7 +635,7 @@ RuntimeValPtr Interpreter::evaluate_expr(Expr* node)
             break;
         }
         case NodeType::MemberExpr: {
-            return *evaluate_memberexpr((MemberExpr*)(node));
+            return evaluate_memberexpr((MemberExpr*)(node));
             break;
         }
         case NodeType::BinaryExpr: {
@@ -338,11 +677,28 @@ RuntimeValPtr Interpreter::evaluate_identifier(Identifier* node)
     return value;
 }
 
+// A wave's sample in the block being rendered, which the scheduler has
+// already rendered it for
+static double read_wave_sample(Wave* source)
+{
+    double value = source->block[block_offset];
+
+    // Oversampled readers land between samples
+    if (sub_sample < 0) {
+        double previous = block_offset > 0 ? source->block[block_offset - 1] : source->carry;
+        value += (value - previous) * sub_sample;
+    }
+    return value;
+}
+
 RuntimeValPtr Interpreter::evaluate_runtimevalpointernode(RuntimeValPointerNode* node)
 {
     if (node->value->type == RuntimeType::Wave) {
-        std::shared_ptr<Wave> value_wave = std::dynamic_pointer_cast<Wave>(node->value);
-        return std::make_shared<Number>(get_sample_and_advance(value_wave));
+        return std::make_shared<Number>(read_wave_sample((Wave*)(node->value.get())));
+    }
+    // A bare buffer in a wave expression plays back in time with the render
+    if (node->value->type == RuntimeType::Buffer) {
+        return std::make_shared<Number>(std::static_pointer_cast<Buffer>(node->value)->sample_at(Wave::global_sample + sub_sample));
     }
     return node->value;
 }
@@ -362,6 +718,33 @@ RuntimeValPtr Interpreter::evaluate_numericliteral(NumericLiteral* node)
     return std::make_shared<Number>(node->value);
 }
 
+// Built-ins, whether the interpreter runs them itself or runtimelib does
+static bool is_builtin_call(const std::string& name)
+{
+    return name == "write" || name == "render" || name == "route" || name == "limit" || Azurite::has_builtin(name);
+}
+
+RuntimeValPtr Interpreter::call_builtin(const std::string& name, std::vector<RuntimeValPtr>& args)
+{
+    if (name == "write") {
+        return write_wave(args);
+    }
+    else if (name == "render") {
+        return render_wave(args);
+    }
+    else if (name == "route") {
+        return route_bus(args);
+    }
+    else if (name == "limit") {
+        return limit_bus(args);
+    }
+    else if (print_muted && name == "print") {
+        // Printed on the dry run
+        return nullptr;
+    }
+    return Azurite::call_runtimelib(name, args);
+}
+
 RuntimeValPtr Interpreter::evaluate_callexpr(CallExpr* node)
 {
     RuntimeValPtr return_val = nullptr;
@@ -369,25 +752,33 @@ RuntimeValPtr Interpreter::evaluate_callexpr(CallExpr* node)
     Identifier* callee = node->callee;
     Arguments* args = node->arguments;
     std::vector<RuntimeValPtr> arg_vals;
-    
-    // Create and enter function scope
-    new_scope();
 
-    // Initialize arguments as variables in function scope
     for (Expr* arg : args->arguments) {
         arg_vals.push_back(evaluate_expr(arg));
     }
 
     // Run built-in function if it exists
-    if (callee->name == "write") {
-        return_val = write_wave(arg_vals);
-    }
-    else if (Azurite::has_builtin(callee->name)) {
-       return_val = Azurite::call_runtimelib(callee->name, arg_vals);
+    if (is_builtin_call(callee->name)) {
+        return call_builtin(callee->name, arg_vals);
     }
+
     // Else look for FunctionDeclaration in environment
-    else {
-        FunctionDeclaration* func = get_func(callee->name);
+    FunctionDeclaration* func = get_func(callee->name);
+    bool discard_result = false;
+    // `return f()` where f ends up returning nothing is an error, as it
+    // would be without tail calls. returning_call is the latest such site.
+    CallExpr* returning_call = nullptr;
+    bool non_returning = false;
+
+    // Create and enter function scope
+    new_scope();
+
+    // Tail calls made by the body come back as TailCall values and are run
+    // here in the same frame, so recursion in tail position uses no stack.
+    // The frame isn't cleared: the caller never resumes, and tail calls are
+    // only marked outside loops, where this frame is the innermost scope the
+    // call was made from, so the callee sees what it would if nested.
+    while (true) {
         // Assuming all params are Identifier expressions
         if (func->params->parameters.size() != arg_vals.size()) {
             // Error: length of argument list does not match parameter list
@@ -400,89 +791,188 @@ RuntimeValPtr Interpreter::evaluate_callexpr(CallExpr* node)
         }
         // Run function body
         return_val = evaluate_stmt(func->body);
+
+        if (return_val == nullptr || return_val->type != RuntimeType::TailCall) {
+            break;
+        }
+
+        std::shared_ptr<TailCall> tail = std::dynamic_pointer_cast<TailCall>(return_val);
+        node = tail->call;
+        func = tail->func;
+        arg_vals = std::move(tail->args);
+        if (tail->discard_result) {
+            non_returning |= returning_call != nullptr;
+            discard_result = true;
+        } else {
+            returning_call = tail->call;
+        }
     }
 
     exit_scope();
 
+    if (returning_call != nullptr && (non_returning || return_val == nullptr)) {
+        runtime_error("Non-returning function cannot be evaluated.", returning_call->begin);
+    }
+
+    // A bare call statement's value never reached the caller
+    if (discard_result) {
+        return nullptr;
+    }
+
     return return_val;
 }
 
-RuntimeValPtr* Interpreter::evaluate_memberexpr(MemberExpr* node)
+RuntimeValPtr Interpreter::evaluate_tailcall(CallExpr* node, bool discard_result)
+{
+    std::string name = node->callee->name;
+
+    // Built-ins don't recurse, just call them
+    if (is_builtin_call(name)) {
+        RuntimeValPtr return_val = evaluate_callexpr(node);
+        if (discard_result) {
+            return nullptr;
+        }
+        if (return_val == nullptr) {
+            runtime_error("Non-returning function cannot be evaluated.", node->begin);
+        }
+        return return_val;
+    }
+
+    std::vector<RuntimeValPtr> arg_vals;
+    for (Expr* arg : node->arguments->arguments) {
+        arg_vals.push_back(evaluate_expr(arg));
+    }
+
+    return std::make_shared<TailCall>(node, get_func(name), arg_vals, discard_result);
+}
+
+RuntimeValPtr Interpreter::evaluate_memberexpr(MemberExpr* node)
+{
+    RuntimeValPtr object;
+
+    // In wave expressions the object is captured already; take it as is
+    // rather than letting a buffer evaluate to its current sample
+    if (node->object->type == NodeType::RuntimeValPointerNode) {
+        object = ((RuntimeValPointerNode*)(node->object))->value;
+    } else {
+        object = evaluate_expr(node->object);
+    }
+
+    if (object->type == RuntimeType::Buffer) {
+        double position;
+        if (!evaluate_number(node->index, position)) {
+            runtime_error("Buffer index must be number.", node->index->begin);
+        }
+        return std::make_shared<Number>(std::static_pointer_cast<Buffer>(object)->sample_at(position));
+    }
+
+    int index;
+    std::shared_ptr<List> object_list = evaluate_member_target(node, object, index);
+
+    // Boxed here only because a value was asked for, arithmetic reads
+    // packed elements through evaluate_number
+    return object_list->get(index);
+}
+
+void Interpreter::assign_memberexpr(MemberExpr* node, RuntimeValPtr value)
 {
     RuntimeValPtr object = evaluate_expr(node->object);
 
+    if (object->type == RuntimeType::Buffer) {
+        runtime_error("Buffers are read-only.", node->begin);
+    }
+
+    int index;
+    std::shared_ptr<List> object_list = evaluate_member_target(node, object, index);
+
+    object_list->set(index, value);
+}
+
+std::shared_ptr<List> Interpreter::evaluate_member_target(MemberExpr* node, RuntimeValPtr object, int& index)
+{
     if (object->type != RuntimeType::List) {
         // Error: only lists can be indexed
         runtime_error("Only lists can be indexed.", node->begin);
     }
 
-    std::shared_ptr<List> object_list = std::dynamic_pointer_cast<List>(object);
-    RuntimeValPtr index = evaluate_expr(node->index);
+    std::shared_ptr<List> object_list = std::static_pointer_cast<List>(object);
+    double index_num;
 
-    if (index->type != RuntimeType::Number) {
+    if (!evaluate_number(node->index, index_num)) {
         // Error: list index must be number
         runtime_error("List index must be number.", node->index->begin);
     }
 
-    std::shared_ptr<Number> index_num = std::dynamic_pointer_cast<Number>(index);
-
-    if (index_num->value >= object_list->elements.size() || index_num->value < 0) {
+    if (index_num >= object_list->size() || index_num < 0) {
         // Error: list index out of range
         runtime_error("List index out of range.", node->index->begin);
     }
 
-    return &(object_list->elements[(int)(index_num->value)]);
+    index = (int)index_num;
+
+    return object_list;
 }
 
-RuntimeValPtr Interpreter::evaluate_binaryexpr(BinaryExpr* node)
+// +, -, *, /, % and ^. False for anything else.
+static bool arithmetic(const std::string& op, double lhs, double rhs, double& value)
 {
-    RuntimeValPtr lhs_val = evaluate_expr(node->lhs);
-    RuntimeValPtr rhs_val = evaluate_expr(node->rhs);
+    if (op == "+") {
+        value = lhs + rhs;
+    } else if (op == "-") {
+        value = lhs - rhs;
+    } else if (op == "*") {
+        value = lhs * rhs;
+    } else if (op == "/") {
+        value = lhs / rhs;
+    } else if (op == "%") {
+        value = fmod(lhs, rhs);
+    } else if (op == "^") {
+        value = pow(lhs, rhs);
+    } else {
+        return false;
+    }
+    return true;
+}
 
+RuntimeValPtr Interpreter::evaluate_binaryexpr(BinaryExpr* node)
+{
     std::string op = node->op.value;
 
-    if (node->op.type == TokenType::ArithmeticOperator
-        || node->op.type == TokenType::ComparisonOperator) {
-            
-        if (lhs_val->type != RuntimeType::Number
-            || rhs_val->type != RuntimeType::Number) {
+    if (node->op.type == TokenType::ArithmeticOperator) {
+        double value;
+        evaluate_number(node, value);
+        return std::make_shared<Number>(value);
+
+    } else if (node->op.type == TokenType::ComparisonOperator) {
+        double lhs, rhs;
+        bool lhs_number = evaluate_number(node->lhs, lhs);
+        bool rhs_number = evaluate_number(node->rhs, rhs);
+
+        if (!lhs_number || !rhs_number) {
             // Error: Arithmetic or comparison expressions must use only numbers
             runtime_error("Arithmetic or comparison expressions must use numbers only.", node->begin);
         }
 
-        std::shared_ptr<Number> lhs_num = std::dynamic_pointer_cast<Number>(lhs_val);
-        std::shared_ptr<Number> rhs_num = std::dynamic_pointer_cast<Number>(rhs_val);
-        // Arithmetic operators
-        if (op == "+") {
-            return std::make_shared<Number>(lhs_num->value + rhs_num->value);
-        } else if (op == "-") {
-            return std::make_shared<Number>(lhs_num->value - rhs_num->value);
-        } else if (op == "*") {
-            return std::make_shared<Number>(lhs_num->value * rhs_num->value);
-        } else if (op == "/") {
-            return std::make_shared<Number>(lhs_num->value / rhs_num->value);
-        } else if (op == "%") {
-            return std::make_shared<Number>(fmod(lhs_num->value, rhs_num->value));
-        } else if (op == "^") {
-            return std::make_shared<Number>(pow(lhs_num->value, rhs_num->value));
-        // Comparison operators
-        } else if (op == "==") {
-            return std::make_shared<Bool>(lhs_num->value == rhs_num->value);
+        if (op == "==") {
+            return std::make_shared<Bool>(lhs == rhs);
         } else if (op == "!=") {
-            return std::make_shared<Bool>(lhs_num->value != rhs_num->value);
+            return std::make_shared<Bool>(lhs != rhs);
         } else if (op == ">") {
-            return std::make_shared<Bool>(lhs_num->value > rhs_num->value);
+            return std::make_shared<Bool>(lhs > rhs);
         } else if (op == "<") {
-            return std::make_shared<Bool>(lhs_num->value < rhs_num->value);
+            return std::make_shared<Bool>(lhs < rhs);
         } else if (op == ">=") {
-            return std::make_shared<Bool>(lhs_num->value >= rhs_num->value);
+            return std::make_shared<Bool>(lhs >= rhs);
         } else if (op == "<=") {
-            return std::make_shared<Bool>(lhs_num->value <= rhs_num->value);
+            return std::make_shared<Bool>(lhs <= rhs);
         }
         // Error: unknown operator
         runtime_error("Unknown operator.", node->op);
 
     } else if (node->op.type == TokenType::LogicalOperator) {
+        RuntimeValPtr lhs_val = evaluate_expr(node->lhs);
+        RuntimeValPtr rhs_val = evaluate_expr(node->rhs);
+
         if (op == "|") {
             return std::make_shared<Bool>(lhs_val->get_truth() | rhs_val->get_truth());
         } else if (op == "&") {
@@ -493,6 +983,87 @@ RuntimeValPtr Interpreter::evaluate_binaryexpr(BinaryExpr* node)
     }
 }
 
+bool Interpreter::evaluate_number(Expr* node, double& value, RuntimeValPtr* other)
+{
+    switch (node->type) {
+        case NodeType::NumericLiteral:
+            value = ((NumericLiteral*)node)->value;
+            return true;
+        case NodeType::NumberPointerNode:
+            value = *((NumberPointerNode*)node)->value;
+            return true;
+        case NodeType::RuntimeValPointerNode: {
+            RuntimeValPtr& pointed = ((RuntimeValPointerNode*)node)->value;
+            if (pointed->type == RuntimeType::Wave) {
+                value = read_wave_sample((Wave*)pointed.get());
+                return true;
+            }
+            if (pointed->type == RuntimeType::Buffer) {
+                value = std::static_pointer_cast<Buffer>(pointed)->sample_at(Wave::global_sample + sub_sample);
+                return true;
+            }
+            if (pointed->type == RuntimeType::Number) {
+                value = std::static_pointer_cast<Number>(pointed)->value;
+                return true;
+            }
+            break;
+        }
+        case NodeType::MemberExpr: {
+            MemberExpr* dnode = (MemberExpr*)node;
+            RuntimeValPtr object = dnode->object->type == NodeType::RuntimeValPointerNode
+                ? ((RuntimeValPointerNode*)dnode->object)->value : evaluate_expr(dnode->object);
+            if (object->type == RuntimeType::Buffer) {
+                double position;
+                if (!evaluate_number(dnode->index, position)) {
+                    runtime_error("Buffer index must be number.", dnode->index->begin);
+                }
+                value = std::static_pointer_cast<Buffer>(object)->sample_at(position);
+                return true;
+            }
+            int index;
+            std::shared_ptr<List> list = evaluate_member_target(dnode, object, index);
+            if (list->get_number(index, value)) {
+                return true;
+            }
+            if (other != nullptr) {
+                *other = list->get(index);
+            }
+            return false;
+        }
+        case NodeType::BinaryExpr: {
+            BinaryExpr* dnode = (BinaryExpr*)node;
+            if (dnode->op.type != TokenType::ArithmeticOperator) {
+                break;
+            }
+            double lhs, rhs;
+            bool lhs_number = evaluate_number(dnode->lhs, lhs);
+            bool rhs_number = evaluate_number(dnode->rhs, rhs);
+
+            if (!lhs_number || !rhs_number) {
+                // Error: Arithmetic or comparison expressions must use only numbers
+                runtime_error("Arithmetic or comparison expressions must use numbers only.", dnode->begin);
+            }
+            if (!arithmetic(dnode->op.value, lhs, rhs, value)) {
+                // Error: unknown operator
+                runtime_error("Unknown operator.", dnode->op);
+            }
+            return true;
+        }
+        default:
+            break;
+    }
+
+    RuntimeValPtr result = evaluate_expr(node);
+    if (result->type == RuntimeType::Number) {
+        value = std::static_pointer_cast<Number>(result)->value;
+        return true;
+    }
+    if (other != nullptr) {
+        *other = result;
+    }
+    return false;
+}
+
 RuntimeValPtr Interpreter::evaluate_unaryexpr(UnaryExpr* node)
 {
     RuntimeValPtr operand_val = evaluate_expr(node->operand);
@@ -527,49 +1098,419 @@ RuntimeValPtr Interpreter::evaluate_unaryexpr(UnaryExpr* node)
 
 RuntimeValPtr Interpreter::evaluate_listdeclaration(ListDeclaration* node)
 {
-    std::vector<RuntimeValPtr> elements;
+    // Numbers go straight into the packed array until something else turns
+    // up, then the list is boxed from there on
+    NumberArray numbers;
+    numbers.reserve(node->elements.size());
+
+    int i = 0;
+    for (; i < node->elements.size(); i++) {
+        double number;
+        RuntimeValPtr other;
+        if (evaluate_number(node->elements[i], number, &other)) {
+            numbers.push_back(number);
+            continue;
+        }
 
-    for (Expr* element : node->elements) {
-        elements.push_back(evaluate_expr(element));
+        std::shared_ptr<List> list = std::make_shared<List>(std::move(numbers));
+        list->unpack();
+        list->elements.reserve(node->elements.size());
+        list->elements.push_back(other);
+        for (i++; i < node->elements.size(); i++) {
+            list->elements.push_back(evaluate_expr(node->elements[i]));
+        }
+        return list;
     }
 
-    return std::make_shared<List>(elements);
+    return std::make_shared<List>(std::move(numbers));
 }
 
 RuntimeValPtr Interpreter::evaluate_wavedeclaration(WaveDeclaration* node)
 {
-    std::cout << "evaluating wavedeclaration\n";
+    AZ_LOG(Trace, Interpreter, "evaluating wavedeclaration");
     Expr* wave_expr = node->wave_expr;
     Expr* freq_expr = node->freq_expr;
     Expr* phase_expr = node->phase_expr;
     Expr* vol_expr = node->vol_expr;
     Expr* pan_expr = node->pan_expr;
 
-    return std::make_shared<Wave>(wave_expr, freq_expr, phase_expr, vol_expr, pan_expr);
+    std::shared_ptr<Wave> wave = std::make_shared<Wave>(wave_expr, freq_expr, phase_expr, vol_expr, pan_expr);
+
+    if (node->oversample_expr != nullptr) {
+        RuntimeValPtr factor = evaluate_expr(node->oversample_expr);
+        if (factor->type != RuntimeType::Number
+                || !valid_oversample(std::static_pointer_cast<Number>(factor)->value)) {
+            runtime_error("Oversampling factor must be 1, 2, 4 or 8.", node->oversample_expr->begin);
+        }
+        wave->oversample = std::static_pointer_cast<Number>(factor)->value;
+    }
+
+    // active: [start, end] in seconds
+    if (node->active_expr != nullptr) {
+        RuntimeValPtr range = evaluate_expr(node->active_expr);
+        std::shared_ptr<List> list = range->type == RuntimeType::List ? std::static_pointer_cast<List>(range) : nullptr;
+        if (list == nullptr || list->size() != 2
+                || list->get(0)->type != RuntimeType::Number || list->get(1)->type != RuntimeType::Number) {
+            runtime_error("A wave's active range must be [start, end] in seconds.", node->active_expr->begin);
+        }
+        wave->active_start = std::round(std::static_pointer_cast<Number>(list->get(0))->value * 44100);
+        wave->active_end = std::round(std::static_pointer_cast<Number>(list->get(1))->value * 44100);
+    }
+
+    return wave;
 }
 
-void Interpreter::simplify_wave(std::shared_ptr<Wave> wave)
+void Interpreter::prepare_wave_graph(std::shared_ptr<Wave> root, std::vector<std::shared_ptr<Wave>>& graph)
 {
-    wave->fast_wave_expr = simplify_expr(wave->wave_expr, wave);
-    wave->fast_freq_expr = simplify_expr(wave->freq_expr, wave);
-    wave->fast_phase_expr = simplify_expr(wave->phase_expr, wave);
-    wave->fast_vol_expr = simplify_expr(wave->vol_expr, wave);
-    wave->fast_pan_expr = simplify_expr(wave->pan_expr, wave);
+    prepare_wave_graph(std::vector<std::shared_ptr<Wave>>{root}, graph);
 }
 
-void Interpreter::desimplify_wave(std::shared_ptr<Wave> wave)
+void Interpreter::prepare_wave_graph(const std::vector<std::shared_ptr<Wave>>& roots, std::vector<std::shared_ptr<Wave>>& graph)
 {
-    delete wave->fast_wave_expr;
-    delete wave->fast_freq_expr;
-    delete wave->fast_phase_expr;
-    delete wave->fast_vol_expr;
-    delete wave->fast_pan_expr;
+    std::unordered_set<Wave*> prepared;
 
-    wave->fast_wave_expr = nullptr;
-    wave->fast_freq_expr = nullptr;
-    wave->fast_phase_expr = nullptr;
-    wave->fast_vol_expr = nullptr;
-    wave->fast_pan_expr = nullptr;
+    graph.clear();
+    for (std::shared_ptr<Wave> root : roots) {
+        if (!prepared.count(root.get())) {
+            prepared.insert(root.get());
+            graph.push_back(root);
+        }
+    }
+
+    // graph doubles as the work list
+    for (int i = 0; i < graph.size(); i++) {
+        std::shared_ptr<Wave> wave = graph[i];
+
+        // Delete old fast exprs before making new ones
+        if (wave->fast_wave_expr != nullptr) {
+            desimplify_wave(wave);
+        }
+
+        wave->sample = 0;
+        wave->phase = 0;
+        wave->rendered_start = INT_MIN;
+        wave->block.assign(BLOCK_SIZE, 0.0);
+        wave->carry = 0.0;
+        wave->random.seed(wave->stream_seed);
+        if (wave->processor != nullptr) {
+            wave->processor->reset();
+        }
+
+        int factor = wave->oversample > 0 ? wave->oversample : default_oversample;
+        if (wave->processor != nullptr) {
+            factor = 1;
+        }
+        if (wave->decimator != nullptr && wave->decimator->factor() != factor) {
+            delete wave->decimator;
+            wave->decimator = nullptr;
+        }
+        if (factor > 1 && wave->decimator == nullptr) {
+            wave->decimator = new Decimator(factor);
+        }
+        if (wave->decimator != nullptr) {
+            wave->decimator->reset();
+        }
+
+        simplify_wave(wave);
+
+        take_rate_annotations(wave);
+
+        SequencerProcessor* sequencer = dynamic_cast<SequencerProcessor*>(wave->processor);
+        if (sequencer != nullptr) {
+            prepare_sequencer(sequencer);
+        }
+
+        // Delays from the last prepare come out again, exprs start over anyway
+        if (wave->processor != nullptr) {
+            std::vector<std::shared_ptr<Wave>> inputs = wave->processor->inputs;
+            for (std::shared_ptr<Wave> input : inputs) {
+                if (dynamic_cast<DelayProcessor*>(input->processor) != nullptr) {
+                    wave->processor->replace_input(input.get(), input->processor->inputs[0]);
+                }
+            }
+        }
+
+        std::vector<std::shared_ptr<Wave>> refs;
+        collect_wave_refs(wave, refs);
+
+        for (std::shared_ptr<Wave> ref : refs) {
+            if (!prepared.count(ref.get())) {
+                prepared.insert(ref.get());
+                graph.push_back(ref);
+            }
+        }
+    }
+
+    // Work that would be the same every sample is done once: constant
+    // subtrees here, subtrees shared between waves once per block, and
+    // ones repeated within a wave once per sample
+    for (std::shared_ptr<Wave> wave : graph) {
+        fold_constant_subexprs(wave, [this](Expr* node) { return evaluate_expr(node); });
+    }
+    hoist_common_subexprs(graph);
+    compensate_latency(graph);
+
+    for (std::shared_ptr<Wave> wave : graph) {
+        select_evaluation(wave);
+    }
+    compute_spans(graph);
+}
+
+// Oversampled waves come out of their decimators DECIMATOR_HALF_TAPS samples
+// late, and so does everything reading them. A wave whose refs are late by
+// different amounts renders as far behind the block as the latest one, its
+// lag, and reads the others through delays so they all line up.
+// render_wave_samples then makes up for the root's own latency. Feedback
+// refs are left alone, they're a block late anyway.
+void Interpreter::compensate_latency(std::vector<std::shared_ptr<Wave>>& graph)
+{
+    bool oversampled = false;
+    for (std::shared_ptr<Wave> wave : graph) {
+        wave->lag = 0;
+        oversampled = oversampled || wave->decimator != nullptr;
+    }
+    if (!oversampled) {
+        return;
+    }
+
+    // How late each wave's block is, -1 while its refs are being visited
+    std::unordered_map<Wave*, int> latency;
+    std::map<std::pair<Wave*, int>, std::shared_ptr<Wave>> delays;
+    std::vector<std::shared_ptr<Wave>> made;
+
+    std::function<void(std::shared_ptr<Wave>)> visit = [&](std::shared_ptr<Wave> wave) {
+        latency[wave.get()] = -1;
+
+        std::vector<std::shared_ptr<Wave>> refs;
+        collect_wave_refs(wave, refs);
+        for (std::shared_ptr<Wave> ref : refs) {
+            if (!latency.count(ref.get())) {
+                visit(ref);
+            }
+        }
+
+        int lag = 0;
+        for (std::shared_ptr<Wave> ref : refs) {
+            lag = std::max(lag, latency[ref.get()]);
+        }
+
+        std::unordered_map<Wave*, std::shared_ptr<Wave>> delayed;
+        for (std::shared_ptr<Wave> ref : refs) {
+            int late = latency[ref.get()];
+            if (late < 0 || late == lag || delayed.count(ref.get())) {
+                continue;
+            }
+
+            // Waves reading the same ref equally far behind share a delay
+            std::shared_ptr<Wave>& delay = delays[{ref.get(), lag - late}];
+            if (delay == nullptr) {
+                delay = std::make_shared<Wave>(new DelayProcessor(ref, lag - late));
+                delay->block.assign(BLOCK_SIZE, 0.0);
+                delay->lag = lag;
+                simplify_wave(delay);
+                latency[delay.get()] = lag;
+                made.push_back(delay);
+            }
+            delayed[ref.get()] = delay;
+        }
+
+        if (wave->processor != nullptr) {
+            for (std::pair<Wave* const, std::shared_ptr<Wave>>& entry : delayed) {
+                wave->processor->replace_input(entry.first, entry.second);
+            }
+        } else if (!delayed.empty()) {
+            replace_wave_refs(wave, [&](std::shared_ptr<Wave> ref) {
+                return delayed.count(ref.get()) ? delayed[ref.get()] : ref;
+            });
+        }
+
+        // Voice kernels were made before and keep pointers to what they read
+        SequencerProcessor* sequencer = dynamic_cast<SequencerProcessor*>(wave->processor);
+        if (sequencer != nullptr && !delayed.empty()) {
+            for (SequencerVoice& voice : sequencer->voices) {
+                std::vector<std::shared_ptr<Wave>> waves = voice.own;
+                waves.push_back(voice.wave);
+                for (std::shared_ptr<Wave> voice_wave : waves) {
+                    if (voice_wave->kernel != nullptr) {
+                        delete voice_wave->kernel;
+                        voice_wave->kernel = nullptr;
+                        select_evaluation(voice_wave);
+                    }
+                }
+            }
+        }
+
+        wave->lag = lag;
+        latency[wave.get()] = lag + (wave->decimator != nullptr ? DECIMATOR_HALF_TAPS : 0);
+    };
+
+    for (std::shared_ptr<Wave> wave : graph) {
+        if (!latency.count(wave.get())) {
+            visit(wave);
+        }
+    }
+    graph.insert(graph.end(), made.begin(), made.end());
+}
+
+void Interpreter::take_rate_annotations(std::shared_ptr<Wave> wave)
+{
+    // control() and audio() around a slot set how often it's evaluated
+    std::function<RuntimeValPtr(Expr*)> evaluate = [this](Expr* node) { return evaluate_expr(node); };
+    wave->freq_rate = ControlParam();
+    wave->phase_rate = ControlParam();
+    wave->vol_rate = ControlParam();
+    take_rate_annotation(wave->fast_freq_expr, wave->freq_rate, evaluate);
+    take_rate_annotation(wave->fast_phase_expr, wave->phase_rate, evaluate);
+    take_rate_annotation(wave->fast_vol_expr, wave->vol_rate, evaluate);
+}
+
+void Interpreter::select_evaluation(std::shared_ptr<Wave> wave)
+{
+    // Kernels evaluate every slot every sample, which they do faster than
+    // the generic path can at control rate, so only a slot asking for
+    // control rate rules one out
+    bool control = wave->freq_rate.rate == ParamRate::Control
+        || wave->phase_rate.rate == ParamRate::Control
+        || wave->vol_rate.rate == ParamRate::Control;
+    if (!control) {
+        wave->kernel = OscillatorKernel::recognize(wave.get());
+    }
+    if (wave->kernel != nullptr) {
+        AZ_LOG(Debug, Render, "wave uses " << wave->kernel->describe() << " kernel");
+        return;
+    }
+
+    if (wave->processor == nullptr) {
+        classify_params(wave);
+    }
+    share_common_subexprs(wave);
+}
+
+// Voices aren't nodes of the graph, they render inside the sequencer's block.
+// The waves they read are its inputs instead.
+void Interpreter::prepare_sequencer(SequencerProcessor* sequencer)
+{
+    sequencer->inputs.clear();
+
+    for (SequencerVoice& voice : sequencer->voices) {
+        std::shared_ptr<Wave> wave = voice.wave;
+        if (wave->fast_wave_expr != nullptr) {
+            desimplify_wave(wave);
+        }
+        simplify_wave(wave);
+        take_rate_annotations(wave);
+
+        // Set to each note's pitch as it starts
+        delete wave->fast_freq_expr;
+        wave->fast_freq_expr = new NumericLiteral(0.0, wave->fast_wave_expr->begin);
+        wave->freq_rate = ControlParam();
+
+        // An envelope in a variable would otherwise run in song time, long
+        // done (or not started) by the time a note plays
+        replace_wave_refs(wave, [](std::shared_ptr<Wave> ref) {
+            EnvelopeProcessor* envelope = dynamic_cast<EnvelopeProcessor*>(ref->processor);
+            return envelope != nullptr ? std::make_shared<Wave>(new EnvelopeProcessor(*envelope)) : ref;
+        });
+
+        fold_constant_subexprs(wave, [this](Expr* node) { return evaluate_expr(node); });
+        select_evaluation(wave);
+
+        voice.own.clear();
+        std::unordered_set<Wave*> visited;
+        collect_voice_waves(wave, voice, sequencer->inputs, visited);
+    }
+
+    sequencer->render_voice = [this](std::shared_ptr<Wave> voice, int start, int count) {
+        render_block(voice, start, count);
+    };
+}
+
+// Sorts the waves a voice reads into its own, which it made itself (calls in
+// its slots and what they made in turn) and which are prepared here in the
+// order they render, and shared ones bound to globals, which become the
+// sequencer's inputs
+void Interpreter::collect_voice_waves(std::shared_ptr<Wave> wave, SequencerVoice& voice,
+    std::vector<std::shared_ptr<Wave>>& inputs, std::unordered_set<Wave*>& visited)
+{
+    std::vector<std::shared_ptr<Wave>> refs;
+    collect_wave_refs(wave, refs);
+
+    for (std::shared_ptr<Wave> ref : refs) {
+        if (visited.count(ref.get())) {
+            continue;
+        }
+        visited.insert(ref.get());
+
+        if (!global_name(ref).empty()) {
+            if (std::find(inputs.begin(), inputs.end(), ref) == inputs.end()) {
+                inputs.push_back(ref);
+            }
+            continue;
+        }
+
+        // Notes start mid-block, which oversampled waves can't
+        ref->oversample = 1;
+        delete ref->decimator;
+        ref->decimator = nullptr;
+        if (ref->fast_wave_expr != nullptr) {
+            desimplify_wave(ref);
+        }
+        simplify_wave(ref);
+        take_rate_annotations(ref);
+        fold_constant_subexprs(ref, [this](Expr* node) { return evaluate_expr(node); });
+        select_evaluation(ref);
+
+        collect_voice_waves(ref, voice, inputs, visited);
+        voice.own.push_back(ref);
+    }
+}
+
+void Interpreter::classify_params(std::shared_ptr<Wave> wave)
+{
+    ControlParam* params[3] = {&wave->freq_rate, &wave->phase_rate, &wave->vol_rate};
+    Expr* exprs[3] = {wave->fast_freq_expr, wave->fast_phase_expr, wave->fast_vol_expr};
+
+    for (int i = 0; i < 3; i++) {
+        if (!params[i]->annotated) {
+            params[i]->rate = classify_param(exprs[i]);
+        }
+        // Oversampled waves evaluate between samples, where there are no
+        // control points
+        if (params[i]->rate == ParamRate::Control && wave->decimator != nullptr) {
+            params[i]->rate = ParamRate::Audio;
+        }
+    }
+
+    AZ_LOG(Debug, Render, "wave params at rates " << (int)wave->freq_rate.rate << " "
+        << (int)wave->phase_rate.rate << " " << (int)wave->vol_rate.rate);
+}
+
+void Interpreter::simplify_wave(std::shared_ptr<Wave> wave)
+{
+    wave->fast_wave_expr = simplify_expr(wave->wave_expr, wave);
+    wave->fast_freq_expr = simplify_expr(wave->freq_expr, wave);
+    wave->fast_phase_expr = simplify_expr(wave->phase_expr, wave);
+    wave->fast_vol_expr = simplify_expr(wave->vol_expr, wave);
+    wave->fast_pan_expr = simplify_expr(wave->pan_expr, wave);
+}
+
+void Interpreter::desimplify_wave(std::shared_ptr<Wave> wave)
+{
+    // Reads waves through the old exprs
+    delete wave->kernel;
+    wave->kernel = nullptr;
+
+    delete wave->fast_wave_expr;
+    delete wave->fast_freq_expr;
+    delete wave->fast_phase_expr;
+    delete wave->fast_vol_expr;
+    delete wave->fast_pan_expr;
+
+    wave->fast_wave_expr = nullptr;
+    wave->fast_freq_expr = nullptr;
+    wave->fast_phase_expr = nullptr;
+    wave->fast_vol_expr = nullptr;
+    wave->fast_pan_expr = nullptr;
 }
 
 Expr* Interpreter::simplify_expr(Expr* node, std::shared_ptr<Wave> wave)
@@ -586,13 +1527,31 @@ Expr* Interpreter::simplify_expr(Expr* node, std::shared_ptr<Wave> wave)
             NumericLiteral* dnode = (NumericLiteral*)node;
             return new NumericLiteral(dnode->value, dnode->begin);
         }
+        case NodeType::StringLiteral: {
+            // Options to built-ins, e.g. control(expr, 16, "cubic")
+            StringLiteral* dnode = (StringLiteral*)node;
+            return new StringLiteral(dnode->value, dnode->begin);
+        }
         case NodeType::MemberExpr: {
             MemberExpr* dnode = (MemberExpr*)node;
-            RuntimeValPtr* val = evaluate_memberexpr(dnode);
-            return new RuntimeValPointerNode(*val, dnode->begin);
+            // Indexing by x (e.g. reading a buffer) has to happen per sample
+            if (references_x(dnode->index)) {
+                return new MemberExpr(simplify_expr(dnode->object, wave), simplify_expr(dnode->index, wave), dnode->begin);
+            }
+            return new RuntimeValPointerNode(evaluate_memberexpr(dnode), dnode->begin);
         }
         case NodeType::CallExpr: {
             CallExpr* dnode = (CallExpr*)node;
+            // Calls that make a wave are evaluated here, and the wave they
+            // make is read like any other. Called per sample they'd get the
+            // current sample of their input and make a new wave every time.
+            if (Azurite::makes_wave(dnode->callee->name) && !references_x(dnode)) {
+                RuntimeValPtr& made = wave->made_waves[dnode];
+                if (made == nullptr) {
+                    made = evaluate_expr(dnode);
+                }
+                return new RuntimeValPointerNode(made, dnode->begin);
+            }
             std::vector<Expr*> arg_vector;
             for (Expr* arg : dnode->arguments->arguments) {
                 arg_vector.push_back(simplify_expr(arg, wave));
@@ -613,15 +1572,37 @@ Expr* Interpreter::simplify_expr(Expr* node, std::shared_ptr<Wave> wave)
     }
 }
 
+bool Interpreter::references_x(Expr* node)
+{
+    switch (node->type) {
+        case NodeType::Identifier:
+            return ((Identifier*)node)->name == "x";
+        case NodeType::MemberExpr:
+            return references_x(((MemberExpr*)node)->object) || references_x(((MemberExpr*)node)->index);
+        case NodeType::CallExpr: {
+            for (Expr* arg : ((CallExpr*)node)->arguments->arguments) {
+                if (references_x(arg)) return true;
+            }
+            return false;
+        }
+        case NodeType::BinaryExpr:
+            return references_x(((BinaryExpr*)node)->lhs) || references_x(((BinaryExpr*)node)->rhs);
+        case NodeType::UnaryExpr:
+            return references_x(((UnaryExpr*)node)->operand);
+        default:
+            return false;
+    }
+}
+
 RuntimeValPtr Interpreter::write_wave(std::vector<RuntimeValPtr> args)
 {
-    if (args.size() < 3) {
-        std::cout << "write(wave, length, filename) takes 3 arguments.\n";
+    if (args.size() < 3 || args.size() > 4) {
+        std::cout << "write(wave, length, bus, gain) takes 3 or 4 arguments.\n";
         return nullptr;
     }
 
-    if (args[0]->type != RuntimeType::Wave) {
-        std::cout << "Only Wave objects can be written.\n";
+    if (args[0]->type != RuntimeType::Wave && args[0]->type != RuntimeType::Buffer) {
+        std::cout << "Only Wave and Buffer objects can be written.\n";
         return nullptr;
     }
 
@@ -631,51 +1612,473 @@ RuntimeValPtr Interpreter::write_wave(std::vector<RuntimeValPtr> args)
     }
 
     if (args[2]->type != RuntimeType::String) {
-        std::cout << "Filename must be a string.\n";
+        std::cout << "Bus name must be a string.\n";
+        return nullptr;
+    }
+
+    if (args.size() > 3 && args[3]->type != RuntimeType::Number) {
+        std::cout << "Gain must be a number.\n";
         return nullptr;
     }
 
-    std::shared_ptr<Wave> wave = std::dynamic_pointer_cast<Wave>(args[0]);
     std::shared_ptr<Number> length = std::dynamic_pointer_cast<Number>(args[1]);
     std::shared_ptr<String> filename = std::dynamic_pointer_cast<String>(args[2]);
+    float gain = args.size() > 3 ? std::static_pointer_cast<Number>(args[3])->value : 1.0;
+
+    if (voices != nullptr) {
+        // Buffers are finished audio, only waves can be kept playing
+        if (args[0]->type == RuntimeType::Wave) {
+            std::shared_ptr<Wave> wave = std::static_pointer_cast<Wave>(args[0]);
+            std::string name = global_name(wave);
+            if (name.empty()) {
+                name = "#" + std::to_string(voices->size());
+            }
+            voices->push_back(LiveVoice(filename->value + ":" + name, wave, gain));
+        }
+        return nullptr;
+    }
+
+    if (dry_run) {
+        get_bus(filename->value);
+
+        uint64_t& hash = bus_hashes.emplace(filename->value, AZ_HASH_SEED).first->second;
+        hash = hash_value(length->value, hash);
+        hash = hash_value(gain, hash);
+
+        if (args[0]->type == RuntimeType::Buffer) {
+            std::shared_ptr<Buffer> source = std::static_pointer_cast<Buffer>(args[0]);
+            hash = source->hash(hash);
+        } else {
+            // Simplified as it would be for the render, capturing the same values
+            std::shared_ptr<Wave> wave = std::static_pointer_cast<Wave>(args[0]);
+            std::vector<std::shared_ptr<Wave>> graph;
+            prepare_wave_graph(wave, graph);
+
+            uint64_t key = 0;
+            if (!hash_wave_graph(wave, key)) {
+                unhashable_buses.insert(filename->value);
+            }
+            hash = hash_value(key, hash);
+        }
+        return nullptr;
+    }
 
-    if (!wave_buffers.count(filename->value)) {
-        wave_buffers[filename->value] = new WaveBuffer();
+    if (filter_buses && !render_buses.count(filename->value)) {
+        return nullptr;
     }
 
-    WaveBuffer* buffer = wave_buffers[filename->value];
+    WaveBuffer* buffer = get_bus(filename->value);
 
     if (length->value > buffer->length) {
         buffer->length = length->value;
     }
+    buffer->reserve(buffer->length);
+
+    if (args[0]->type == RuntimeType::Buffer) {
+        // Already rendered, just mix it in
+        std::shared_ptr<Buffer> source = std::static_pointer_cast<Buffer>(args[0]);
+        int count = std::min((int)length->value, source->size());
+
+        if (source->file == nullptr) {
+            mix_add(buffer->data.data(), source->samples.data(), count, gain);
+        } else {
+            // Converted a chunk at a time rather than all at once
+            std::vector<float> chunk(WAVE_READ_BLOCK);
+            for (int pos = 0; pos < count; pos += WAVE_READ_BLOCK) {
+                int n = std::min(WAVE_READ_BLOCK, count - pos);
+                source->read(pos, n, chunk.data());
+                mix_add(buffer->data.data() + pos, chunk.data(), n, gain);
+            }
+        }
+    } else {
+        // The dry run didn't render it, so anything it prints hasn't been
+        bool muted = print_muted;
+        print_muted = false;
+        render_wave_samples(std::static_pointer_cast<Wave>(args[0]), length->value, buffer->data.data(), gain);
+        print_muted = muted;
+    }
+
+    AZ_LOG(Debug, Render, "written wave to " << filename->value << " (" << length->value << " samples)");
+
+    return nullptr;
+}
+
+RuntimeValPtr Interpreter::render_wave(std::vector<RuntimeValPtr> args)
+{
+    if (args.size() < 2) {
+        std::cout << "render(wave, length) takes 2 arguments.\n";
+        return nullptr;
+    }
+
+    if (args[0]->type != RuntimeType::Wave) {
+        std::cout << "Only Wave objects can be rendered.\n";
+        return nullptr;
+    }
+
+    if (args[1]->type != RuntimeType::Number) {
+        std::cout << "Length must be a number.\n";
+        return nullptr;
+    }
 
-    // Write each sample to buffer
-    for (int i = 0; i < length->value; i++) {
-        Wave::global_sample = i;
+    int length = std::max(0.0, std::static_pointer_cast<Number>(args[1])->value);
+    std::vector<float> samples(length, 0.f);
 
-        double sample = get_sample_and_advance(wave);
+    render_wave_samples(std::static_pointer_cast<Wave>(args[0]), length, samples.data());
 
-        buffer->data[i] += sample;
+    AZ_LOG(Debug, Render, "rendered wave to buffer (" << length << " samples)");
+
+    return std::make_shared<Buffer>(std::move(samples));
+}
+
+RuntimeValPtr Interpreter::route_bus(std::vector<RuntimeValPtr> args)
+{
+    if (args.size() < 2 || args.size() > 3) {
+        std::cout << "route(bus, target, gain) takes 2 or 3 arguments.\n";
+        return nullptr;
     }
 
-    std::cout << "----written wave----\n";
+    if (args[0]->type != RuntimeType::String || args[1]->type != RuntimeType::String) {
+        std::cout << "Bus names must be strings.\n";
+        return nullptr;
+    }
+
+    if (args.size() > 2 && args[2]->type != RuntimeType::Number) {
+        std::cout << "Gain must be a number.\n";
+        return nullptr;
+    }
+
+    BusRoute route;
+    route.from = std::static_pointer_cast<String>(args[0])->value;
+    route.to = std::static_pointer_cast<String>(args[1])->value;
+    route.gain = args.size() > 2 ? std::static_pointer_cast<Number>(args[2])->value : 1.0;
+
+    get_bus(route.from);
+    get_bus(route.to);
+    bus_routes.push_back(route);
 
     return nullptr;
 }
 
-double Interpreter::get_sample_and_advance(std::shared_ptr<Wave> wave)
+RuntimeValPtr Interpreter::limit_bus(std::vector<RuntimeValPtr> args)
 {
-    if (Wave::global_sample == 0) {
-        // Delete old fast exprs before making new ones
-        if (wave->fast_wave_expr != nullptr) {
-            desimplify_wave(wave);
+    if (args.size() < 1 || args.size() > 3) {
+        std::cout << "limit(bus, ceiling_db, lookahead_ms) takes 1 to 3 arguments.\n";
+        return nullptr;
+    }
+
+    if (args[0]->type != RuntimeType::String) {
+        std::cout << "Bus name must be a string.\n";
+        return nullptr;
+    }
+
+    double settings[2] = {-1.0, 5.0};
+    for (int i = 1; i < args.size(); i++) {
+        if (args[i]->type != RuntimeType::Number) {
+            std::cout << "Limiter settings must be numbers.\n";
+            return nullptr;
         }
-        
-        wave->sample = 0;
-        wave->phase = 0;
+        settings[i - 1] = std::static_pointer_cast<Number>(args[i])->value;
+    }
+
+    std::string name = std::static_pointer_cast<String>(args[0])->value;
+    if (dry_run) {
+        uint64_t& hash = bus_hashes.emplace(name, AZ_HASH_SEED).first->second;
+        hash = hash_bytes(settings, sizeof(settings), hash_string("limit", hash));
+    }
+
+    WaveBuffer* bus = get_bus(name);
+    delete bus->limiter;
+    bus->limiter = new Limiter(settings[0], settings[1]);
+
+    return nullptr;
+}
+
+void Interpreter::render_wave_samples(std::shared_ptr<Wave> wave, int length, float* out, float gain)
+{
+    Azurite::Stats::PhaseTimer timer(StatsPhase::Render);
+    if (Azurite::Stats::enabled) {
+        Azurite::Stats::count_rendered(length);
+    }
+
+    std::vector<std::shared_ptr<Wave>> graph;
+    prepare_wave_graph(wave, graph);
+
+    WaveGraph dag(wave);
+
+    uint64_t key;
+    RenderCacheEntry* entry = nullptr;
+    int start = 0;
+
+    // Waves that call script functions or print need the interpreter
+    // to themselves, so any of those keeps the whole graph serial
+    bool parallel = num_threads > 1 && !dag.is_chain;
+    for (int i = 0; i < dag.nodes.size() && parallel; i++) {
+        parallel = is_pure_wave(dag.nodes[i]);
+    }
+    if (parallel && pool == nullptr) {
+        pool = new ThreadPool(num_threads - 1);
+    }
+
+    AZ_LOG(Debug, Render, "wave graph has " << dag.nodes.size() << " nodes, " << dag.feedback_edges << " feedback edges"
+        << (parallel ? ", rendering in parallel" : ""));
+
+    if (hash_wave_graph(wave, key)) {
+        entry = render_cache->find(key);
+
+        // Feedback delays are tied to the block grid and processor and filter
+        // state isn't snapshotted, so only graphs without either can continue
+        // from an arbitrary sample. Others start over.
+        if (entry != nullptr && (dag.feedback_edges > 0 || dag.stateful_nodes > 0)
+                && length > entry->samples.size()) {
+            entry->samples.clear();
+        }
+
+        if (entry != nullptr && !entry->samples.empty()) {
+            int cached = std::min(length, (int)entry->samples.size());
+            mix_add(out, entry->samples.data(), cached, gain);
+
+            if (cached == length) {
+                AZ_LOG(Debug, Render, "render cache hit (" << length << " samples)");
+                return;
+            }
+
+            // Pick up where the cached render stopped
+            for (int i = 0; i < graph.size(); i++) {
+                graph[i]->phase = entry->states[i].phase;
+                graph[i]->x = entry->states[i].x;
+                graph[i]->sample = entry->states[i].sample;
+                graph[i]->random = entry->states[i].random;
+            }
+            start = cached;
+
+            AZ_LOG(Debug, Render, "render cache extends " << cached << " to " << length << " samples");
+        } else if (entry == nullptr) {
+            entry = render_cache->insert(key);
+        }
+    }
+
+    if (entry != nullptr) {
+        entry->samples.resize(length);
+    }
+
+    // The root comes out latency samples late when it reads oversampled
+    // waves, so the render runs that much longer and drops the start
+    int latency = wave->lag + (wave->decimator != nullptr ? DECIMATOR_HALF_TAPS : 0);
+
+    // Every wave in the graph renders a block, dependencies first, then the
+    // root's block is written out. Silent blocks are skipped node by node,
+    // and nothing after the root goes quiet for good matters
+    int end = std::min(length, wave->span_end) + latency;
+    for (int block_start = start; block_start < end; block_start += BLOCK_SIZE) {
+        int count = std::min(BLOCK_SIZE, length + latency - block_start);
+
+        render_graph_block(dag, block_start, count, parallel);
+
+        int skip = std::max(0, latency - block_start);
+        int at = block_start + skip - latency;
+        if (skip >= count) {
+            continue;
+        }
+
+        // The cache keeps samples before gain
+        if (at + count - skip > wave->span_start) {
+            mix_add(out + at, wave->block.data() + skip, count - skip, gain);
+        }
+        if (entry != nullptr) {
+            std::copy(wave->block.begin() + skip, wave->block.begin() + count, entry->samples.begin() + at);
+        }
+    }
+
+    if (entry != nullptr) {
+        entry->states.resize(graph.size());
+        for (int i = 0; i < graph.size(); i++) {
+            entry->states[i] = {graph[i]->phase, graph[i]->x, graph[i]->sample, graph[i]->random};
+        }
+        render_cache->trim();
+    }
+}
+
+void Interpreter::render_graph_block(WaveGraph& dag, int start, int count, bool parallel)
+{
+    if (!parallel) {
+        for (std::shared_ptr<Wave> node : dag.nodes) {
+            render_block(node, start, count);
+        }
+        return;
+    }
+
+    // A node is queued once the last wave it reads has rendered, so the
+    // only barrier is the end of the block
+    std::vector<std::atomic<int>> remaining(dag.nodes.size());
+    for (int i = 0; i < dag.nodes.size(); i++) {
+        remaining[i] = dag.deps[i].size();
     }
 
-    wave->x = Wave::global_sample;
+    std::function<void(int)> run_node = [&](int i) {
+        render_block(dag.nodes[i], start, count);
+
+        for (int dependent : dag.dependents[i]) {
+            if (--remaining[dependent] == 0) {
+                pool->submit([&run_node, dependent] { run_node(dependent); });
+            }
+        }
+    };
+
+    for (int i = 0; i < dag.nodes.size(); i++) {
+        if (dag.deps[i].empty()) {
+            pool->submit([&run_node, i] { run_node(i); });
+        }
+    }
+
+    pool->wait();
+}
+
+void Interpreter::render_block(std::shared_ptr<Wave> wave, int start, int count)
+{
+    // Blocks are only ever short at the end of a render
+    wave->carry = wave->block[BLOCK_SIZE - 1];
+    start -= wave->lag;
+
+    if (wave->processor != nullptr) {
+        Wave::global_sample = start;
+        wave->processor->process(wave->block, start, count);
+        return;
+    }
+
+    if (wave->decimator == nullptr && (start >= wave->span_end || start + count <= wave->span_start)) {
+        skip_block(wave, start, count);
+        return;
+    }
+
+    if (wave->kernel != nullptr) {
+        wave->kernel->render(wave.get(), start, count);
+    } else {
+        Azurite::set_current_random(&wave->random);
+        block_end = start + count - 1;
+
+        if (wave->decimator != nullptr) {
+            render_oversampled_block(wave, start, count);
+        } else {
+            for (int i = 0; i < count; i++) {
+                Wave::global_sample = start + i;
+                block_offset = i;
+
+                // Written after evaluating so a wave reading itself gets last block
+                wave->block[i] = get_sample_and_advance(wave);
+            }
+        }
+
+        Azurite::set_current_random(nullptr);
+    }
+
+    // The decimator's output is from that much earlier than the points
+    if (wave->decimator != nullptr) {
+        start -= DECIMATOR_HALF_TAPS;
+    }
+
+    // The ends of an active range that fall inside the block
+    int first = std::min((long)count, std::max(0L, (long)wave->span_start - start));
+    int last = std::max((long)first, std::min((long)count, (long)wave->span_end - start));
+    std::fill(wave->block.begin(), wave->block.begin() + first, 0.0);
+    std::fill(wave->block.begin() + last, wave->block.begin() + count, 0.0);
+}
+
+// A block where the wave is silent. Only its phase moves on, by the same
+// steps evaluating it would have taken.
+void Interpreter::skip_block(std::shared_ptr<Wave> wave, int start, int count)
+{
+    std::fill(wave->block.begin(), wave->block.begin() + count, 0.0);
+
+    bool constant = wave->freq_rate.rate == ParamRate::Constant
+        || (wave->kernel != nullptr && wave->kernel->freq.core == KernelChain::Core::Constant);
+    double freq = 0.0;
+    if (constant && wave->kernel != nullptr) {
+        freq = wave->kernel->freq.value;
+    }
+
+    Azurite::set_current_random(&wave->random);
+    block_end = start + count - 1;
+
+    for (int i = 0; i < count; i++) {
+        Wave::global_sample = start + i;
+        block_offset = i;
+        if (Wave::global_sample < wave->sample) {
+            continue;
+        }
+
+        if (!constant || wave->kernel == nullptr) {
+            wave->x = Wave::global_sample;
+            eval_stamp++;
+            RuntimeValPtr value = evaluate_param(wave, wave->freq_rate, wave->fast_freq_expr);
+            if (value->type != RuntimeType::Number) {
+                std::cout << "All wave functions must evaluate to numbers.\n";
+                break;
+            }
+            freq = std::static_pointer_cast<Number>(value)->value;
+        }
+
+        wave->sample++;
+        wave->phase += TAU * (freq) / 44100;
+    }
+
+    // Control-rate phase and vol are left with the points they'd have had at
+    // the end of the block, so they pick up where evaluating would have
+    Wave::global_sample = start + count - 1;
+    block_offset = count - 1;
+    skip_control_points(wave, wave->phase_rate, wave->fast_phase_expr, start, count);
+    skip_control_points(wave, wave->vol_rate, wave->fast_vol_expr, start, count);
+
+    Azurite::set_current_random(nullptr);
+}
+
+void Interpreter::skip_control_points(std::shared_ptr<Wave> wave, ControlParam& param, Expr* expr, int start, int count)
+{
+    if (param.rate != ParamRate::Control) {
+        return;
+    }
+
+    int end = start + count - 1;
+    param.started = true;
+    param.next_time = end;
+    param.next = evaluate_control_point(wave, expr, end);
+    // Only cubic looks at the point before
+    param.last_time = end;
+    param.last = param.next;
+    if (param.cubic && end - param.interval >= start) {
+        param.last_time = end - param.interval;
+        param.last = evaluate_control_point(wave, expr, param.last_time);
+    }
+}
+
+// Evaluates factor points per sample, the last one on the sample itself,
+// and filters them back down into the block, DECIMATOR_HALF_TAPS samples
+// late. Waves reading it lag behind to match (see compensate_latency).
+void Interpreter::render_oversampled_block(std::shared_ptr<Wave> wave, int start, int count)
+{
+    static thread_local std::vector<double> points;
+
+    int factor = wave->decimator->factor();
+    points.resize(count * factor);
+
+    for (int i = 0; i < count; i++) {
+        Wave::global_sample = start + i;
+        block_offset = i;
+
+        for (int k = 0; k < factor; k++) {
+            sub_sample = (k + 1.0) / factor - 1.0;
+            points[i * factor + k] = get_sample_and_advance(wave);
+        }
+    }
+    sub_sample = 0.0;
+
+    wave->decimator->process(points.data(), wave->block.data(), count);
+}
+
+double Interpreter::get_sample_and_advance(std::shared_ptr<Wave> wave)
+{
+    // Waves are reset and simplified by prepare_wave_graph before a render
+    wave->x = Wave::global_sample + sub_sample;
+    eval_stamp++;
 
     if (wave->fast_wave_expr == nullptr) {
         simplify_wave(wave);
@@ -683,9 +2086,9 @@ double Interpreter::get_sample_and_advance(std::shared_ptr<Wave> wave)
 
     // Evaluate height of wave with // TODO add panning
     // height = waveform(phase + phaseoffset) * vol
-    RuntimeValPtr freq = evaluate_expr(wave->fast_freq_expr);
-    RuntimeValPtr phase_offset = evaluate_expr(wave->fast_phase_expr);
-    RuntimeValPtr vol = evaluate_expr(wave->fast_vol_expr);
+    RuntimeValPtr freq = evaluate_param(wave, wave->freq_rate, wave->fast_freq_expr);
+    RuntimeValPtr phase_offset = evaluate_param(wave, wave->phase_rate, wave->fast_phase_expr);
+    RuntimeValPtr vol = evaluate_param(wave, wave->vol_rate, wave->fast_vol_expr);
 
     if (freq->type != RuntimeType::Number
         || phase_offset->type != RuntimeType::Number
@@ -700,6 +2103,11 @@ double Interpreter::get_sample_and_advance(std::shared_ptr<Wave> wave)
     double vol_num = std::dynamic_pointer_cast<Number>(vol)->value;
 
     wave->x = wave->phase + phase_offset_num;
+    // Oversampled points before the sample go back along its step, so the
+    // point on the sample has the phase the wave would have at 1x
+    if (sub_sample < 0) {
+        wave->x += TAU * freq_num * sub_sample / 44100;
+    }
     RuntimeValPtr height = evaluate_expr(wave->fast_wave_expr);
 
     if (height->type != RuntimeType::Number) {
@@ -711,8 +2119,9 @@ double Interpreter::get_sample_and_advance(std::shared_ptr<Wave> wave)
 
     double final_height = height_num * vol_num;
 
-    // Advance if sample is new
-    if (Wave::global_sample >= wave->sample) {
+    // Advance if sample is new. Oversampled waves advance on the last
+    // point, the one on the sample.
+    if (sub_sample == 0 && Wave::global_sample >= wave->sample) {
         wave->sample++;
 
         // phase += 2pi*(freq at sample)/samplerate
@@ -720,4 +2129,71 @@ double Interpreter::get_sample_and_advance(std::shared_ptr<Wave> wave)
     }
 
     return final_height;
-}
\ No newline at end of file
+}
+RuntimeValPtr Interpreter::evaluate_param(std::shared_ptr<Wave> wave, ControlParam& param, Expr* expr)
+{
+    switch (param.rate) {
+        case ParamRate::Constant:
+            if (param.constant == nullptr) {
+                param.constant = evaluate_expr(expr);
+            }
+            return param.constant;
+        case ParamRate::Control:
+            break;
+        default:
+            return evaluate_expr(expr);
+    }
+
+    int time = Wave::global_sample;
+    // Sequencer voices render the part of a block before their note starts,
+    // which is thrown away
+    if (time < 0) {
+        return evaluate_expr(expr);
+    }
+    if (!param.started || time > param.next_time) {
+        if (!param.started) {
+            param.last_time = time;
+            param.last = evaluate_control_point(wave, expr, time);
+            param.before_time = param.last_time;
+            param.before = param.last;
+            param.started = true;
+        } else {
+            param.before_time = param.last_time;
+            param.before = param.last;
+            param.last_time = param.next_time;
+            param.last = param.next;
+        }
+
+        param.next_time = param.next_point(time, block_end);
+        param.next = param.next_time == param.last_time ? param.last
+            : evaluate_control_point(wave, expr, param.next_time);
+    }
+
+    return std::make_shared<Number>(param.at(time));
+}
+
+// Evaluates a control-rate slot as if at sample time of the current block
+double Interpreter::evaluate_control_point(std::shared_ptr<Wave> wave, Expr* expr, int time)
+{
+    int sample = Wave::global_sample;
+    int offset = block_offset;
+
+    Wave::global_sample = time;
+    block_offset = offset + time - sample;
+    wave->x = time;
+    // Shared subexpressions mustn't carry values between this point and
+    // the sample being evaluated
+    eval_stamp++;
+
+    RuntimeValPtr value = evaluate_expr(expr);
+
+    Wave::global_sample = sample;
+    block_offset = offset;
+    wave->x = sample;
+    eval_stamp++;
+
+    if (value->type != RuntimeType::Number) {
+        script_error("control() expressions must evaluate to numbers.");
+    }
+    return std::static_pointer_cast<Number>(value)->value;
+}
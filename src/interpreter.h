@@ -4,6 +4,8 @@
 #include <cmath>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 
 #include "ast.h"
 #include "parser.h"
@@ -13,9 +15,37 @@
 #include "error.h"
 #include "wavewriter.h"
 #include "exprreduction.h"
+#include "log.h"
+#include "astcache.h"
+#include "rendercache.h"
+#include "wavegraph.h"
+#include "threadpool.h"
+#include "sequencer.h"
 
 typedef std::shared_ptr<RuntimeVal> RuntimeValPtr;
 
+// A .wav bus kept in memory instead of being written out
+struct RenderedBus {
+    std::string name;
+    std::vector<float> samples;
+};
+
+// A wave written out by a script running in watch mode, which keeps it
+// playing instead of rendering it
+struct LiveVoice {
+    // Output bus and the global the wave is bound to (or its write order),
+    // used to find the same voice after a reload
+    std::string name;
+    std::shared_ptr<Wave> wave;
+    float gain;
+
+    // The waves this voice renders, set by start_voices
+    std::vector<std::shared_ptr<Wave>> graph;
+    std::shared_ptr<WaveGraph> dag;
+
+    LiveVoice(std::string name, std::shared_ptr<Wave> wave, float gain)
+        : name(name), wave(wave), gain(gain) {}
+};
 
 class Interpreter
 {
@@ -24,15 +54,88 @@ public:
     Interpreter();
     ~Interpreter();
 
-    void interpret(std::string source);
+    // Parses source, or loads the parsed program from cache_path when the
+    // cache matches the source. An empty cache_path disables caching.
+    void interpret(std::string source, std::string cache_path = "");
+    // Runs a program parsed elsewhere. The caller keeps ownership, and the
+    // program may be run by several interpreters at once.
+    void interpret_program(Program* program);
+
+    // Threads used to render independent waves side by side (1 = serial)
+    void set_threads(int num_threads);
+    // Oversampling factor for waves that don't set their own
+    void set_oversample(int factor);
+    static bool valid_oversample(int factor);
+
+    // Samples written to .wav files by interpret()
+    long samples_written();
+
+    // Collect .wav buses into out instead of writing the files
+    void capture_output(std::vector<RenderedBus>* out);
+    // Use a render cache that outlives this interpreter. It must not be
+    // used by another interpreter at the same time.
+    void set_render_cache(RenderCache* cache);
+
+    // Incremental renders. A dry run executes the script and hashes what
+    // each bus would receive, without rendering or writing anything.
+    void set_dry_run(bool dry_run);
+    // For a run after a dry run, which has already printed. print() then
+    // only works in waves being written, which the dry run didn't render.
+    void mute_print(bool mute);
+    // After a dry run: the .wav buses the script writes
+    std::vector<std::string> output_buses();
+    // After a dry run: hash of what bus would contain. False if it can't be
+    // hashed (waves calling script functions or print, routing cycles).
+    bool output_hash(const std::string& bus, uint64_t& hash);
+    // After a dry run: outputs and every bus routed into them
+    std::unordered_set<std::string> buses_feeding(const std::vector<std::string>& outputs);
+    // Only render writes to these buses and only write these .wav files
+    void render_only(const std::unordered_set<std::string>& buses);
+
+    // Collect written waves into out instead of rendering them
+    void collect_voices(std::vector<LiveVoice>* out);
+    // Prepare the collected voices to start playing at sample position. They
+    // are prepared together, since they can share waves.
+    void start_voices(std::vector<LiveVoice>& voices, int position);
+    // Render the voice's next block into voice.wave->block. Waves it shares
+    // with voices already rendered for this block aren't rendered again.
+    void render_voice(LiveVoice& voice, int start, int count);
+    // Name of the global variable holding wave, or "" if there isn't one
+    std::string global_name(std::shared_ptr<Wave> wave);
 
 private:
     Parser parser;
     Program* program;
+    bool owns_program;
     Environment* global_scope;
     std::vector<Environment*> scopes;
 
     std::unordered_map<std::string, WaveBuffer*> wave_buffers;
+    // route(from, to, gain) calls, mixed in when the script ends
+    struct BusRoute {
+        std::string from;
+        std::string to;
+        float gain;
+    };
+    std::vector<BusRoute> bus_routes;
+    RenderCache own_render_cache;
+    RenderCache* render_cache;
+    std::vector<RenderedBus>* captured;
+    std::vector<LiveVoice>* voices;
+
+    bool dry_run;
+    bool print_muted;
+    // Per bus hash of its writes and limiter during a dry run
+    std::unordered_map<std::string, uint64_t> bus_hashes;
+    std::unordered_set<std::string> unhashable_buses;
+    bool filter_buses;
+    std::unordered_set<std::string> render_buses;
+    int num_threads;
+    int default_oversample;
+    ThreadPool* pool;
+    long written;
+
+    void run_program();
 
     RuntimeValPtr get_var(std::string name);
     FunctionDeclaration* get_func(std::string name);
@@ -55,19 +158,56 @@ private:
     RuntimeValPtr evaluate_stringliteral(StringLiteral* node);
     RuntimeValPtr evaluate_numericliteral(NumericLiteral* node);
     RuntimeValPtr evaluate_callexpr(CallExpr* node);
-    // double pointer because in assignexpr you may reassign
-    // a list element, which requires changing the pointer in
-    // the vector in place
-    RuntimeValPtr* evaluate_memberexpr(MemberExpr* node);
+    RuntimeValPtr call_builtin(const std::string& name, std::vector<RuntimeValPtr>& args);
+    RuntimeValPtr evaluate_tailcall(CallExpr* node, bool discard_result);
+    RuntimeValPtr evaluate_memberexpr(MemberExpr* node);
+    // Assigning goes through the List so packed lists can store numbers
+    // in place (or box themselves for other values)
+    void assign_memberexpr(MemberExpr* node, RuntimeValPtr value);
+    std::shared_ptr<List> evaluate_member_target(MemberExpr* node, RuntimeValPtr object, int& index);
     RuntimeValPtr evaluate_binaryexpr(BinaryExpr* node);
+    // Evaluates an expression as a double, without boxing it where it can:
+    // literals, x, wave and buffer samples, packed list elements and
+    // arithmetic on them. Returns false if the value isn't a number, with
+    // the value in other if given.
+    bool evaluate_number(Expr* node, double& value, RuntimeValPtr* other = nullptr);
     RuntimeValPtr evaluate_unaryexpr(UnaryExpr* node);
     RuntimeValPtr evaluate_listdeclaration(ListDeclaration* node);
     RuntimeValPtr evaluate_wavedeclaration(WaveDeclaration* node);
 
+    // Reset and re-simplify every wave reachable from root, in a fixed
+    // order that render cache states are stored in
+    void prepare_wave_graph(std::shared_ptr<Wave> root, std::vector<std::shared_ptr<Wave>>& graph);
+    void prepare_wave_graph(const std::vector<std::shared_ptr<Wave>>& roots, std::vector<std::shared_ptr<Wave>>& graph);
     void simplify_wave(std::shared_ptr<Wave> wave);
     void desimplify_wave(std::shared_ptr<Wave> wave);
     Expr* simplify_expr(Expr* node, std::shared_ptr<Wave> wave);
+    bool references_x(Expr* node);
 
     RuntimeValPtr write_wave(std::vector<RuntimeValPtr> args);
+    RuntimeValPtr render_wave(std::vector<RuntimeValPtr> args);
+    RuntimeValPtr route_bus(std::vector<RuntimeValPtr> args);
+    RuntimeValPtr limit_bus(std::vector<RuntimeValPtr> args);
+    WaveBuffer* get_bus(std::string name);
+    void mix_down_buses();
+    bool hash_bus(const std::string& name, uint64_t& hash, std::unordered_set<std::string>& visiting);
+    void render_block(std::shared_ptr<Wave> wave, int start, int count);
+    void render_graph_block(WaveGraph& dag, int start, int count, bool parallel);
+    void render_oversampled_block(std::shared_ptr<Wave> wave, int start, int count);
+    // Adds length samples of wave into out, starting from sample 0
+    void render_wave_samples(std::shared_ptr<Wave> wave, int length, float* out, float gain = 1.f);
     double get_sample_and_advance(std::shared_ptr<Wave> wave);
+    void skip_block(std::shared_ptr<Wave> wave, int start, int count);
+    void skip_control_points(std::shared_ptr<Wave> wave, ControlParam& param, Expr* expr, int start, int count);
+    void take_rate_annotations(std::shared_ptr<Wave> wave);
+    void compensate_latency(std::vector<std::shared_ptr<Wave>>& graph);
+    // Kernel or generic path, once the wave's exprs are final
+    void select_evaluation(std::shared_ptr<Wave> wave);
+    void prepare_sequencer(SequencerProcessor* sequencer);
+    void collect_voice_waves(std::shared_ptr<Wave> wave, SequencerVoice& voice,
+        std::vector<std::shared_ptr<Wave>>& inputs, std::unordered_set<Wave*>& visited);
+    // Sets the rate of freq, phase and vol slots without an annotation
+    void classify_params(std::shared_ptr<Wave> wave);
+    RuntimeValPtr evaluate_param(std::shared_ptr<Wave> wave, ControlParam& param, Expr* expr);
+    double evaluate_control_point(std::shared_ptr<Wave> wave, Expr* expr, int time);
 };
@@ -88,7 +88,7 @@ std::vector<Token> Lexer::tokenize(std::string source_)
             case '\"': {
                 // Eat beginning quote
                 eat();
-                std::cout << "stringing\n";
+                AZ_LOG(Trace, Lexer, "stringing");
                 std::string result = "";
                 int begin_line = line;
                 int begin_col = col;
@@ -96,8 +96,7 @@ std::vector<Token> Lexer::tokenize(std::string source_)
                     result += eat();
                 }
                 if (ptr == source.length()) {
-                    std::cout << "Expected ending quote.\n";
-                    exit(1);
+                    script_error("Expected ending quote.");
                 }
                 // Eat ending quote
                 eat();
@@ -121,8 +120,7 @@ std::vector<Token> Lexer::tokenize(std::string source_)
                         if (at() == '.') dec_count++;
                         result += eat();
                         if (dec_count > 1) {
-                            std::cout << "Invalid number.\n";
-                            exit(1);
+                            script_error("Invalid number.");
                         }
                     }
 
@@ -4,6 +4,8 @@
 #include <vector>
 
 #include "token.h"
+#include "log.h"
+#include "error.h"
 
 class Lexer
 {
@@ -0,0 +1,111 @@
+#include "limiter.h"
+#include "processor.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define TRUE_PEAK_PHASES 4
+#define TRUE_PEAK_TAPS 8
+
+// Windowed-sinc interpolator split into phases: phase k gives the value
+// k / 4 of a sample after the centre of the history
+static const std::vector<double>& true_peak_filter()
+{
+    static std::vector<double> taps = [] {
+        int length = TRUE_PEAK_PHASES * TRUE_PEAK_TAPS;
+        std::vector<double> prototype(length);
+        double centre = (length - 1) / 2.0;
+
+        for (int i = 0; i < length; i++) {
+            double t = (i - centre) / TRUE_PEAK_PHASES;
+            double sinc = t == 0 ? 1.0 : std::sin(M_PI * t) / (M_PI * t);
+            double window = 0.5 - 0.5 * std::cos(2.0 * M_PI * (i + 0.5) / length);
+            prototype[i] = sinc * window;
+        }
+        return prototype;
+    }();
+    return taps;
+}
+
+Limiter::Limiter(double ceiling_db, double lookahead_ms, double release_ms)
+    : ceiling(std::pow(10.0, ceiling_db / 20.0)),
+    lookahead(std::max(1, (int)(lookahead_ms * SAMPLE_RATE / 1000.0))),
+    release(1.0 - std::exp(-1.0 / (std::max(release_ms, 1.0) * SAMPLE_RATE / 1000.0)))
+{
+    reset();
+}
+
+int Limiter::latency()
+{
+    return lookahead - 1 + TRUE_PEAK_DELAY;
+}
+
+void Limiter::reset()
+{
+    history.assign(TRUE_PEAK_TAPS, 0.0);
+    history_pos = 0;
+    released_gain = 1.0;
+    hold.clear();
+    smooth.assign(lookahead, 1.0);
+    smooth_sum = lookahead;
+    delay.assign(latency() + 1, 0.f);
+    delay_pos = 0;
+    step = 0;
+}
+
+double Limiter::true_peak()
+{
+    const std::vector<double>& taps = true_peak_filter();
+    double peak = 0.0;
+
+    for (int phase = 0; phase < TRUE_PEAK_PHASES; phase++) {
+        double sum = 0.0;
+        for (int t = 0; t < TRUE_PEAK_TAPS; t++) {
+            // Oldest sample first
+            double x = history[(history_pos + t) % TRUE_PEAK_TAPS];
+            sum += x * taps[t * TRUE_PEAK_PHASES + (TRUE_PEAK_PHASES - 1 - phase)];
+        }
+        peak = std::max(peak, std::fabs(sum));
+    }
+
+    return std::max(peak, std::fabs(history[(history_pos + TRUE_PEAK_TAPS - 1 - TRUE_PEAK_DELAY) % TRUE_PEAK_TAPS]));
+}
+
+void Limiter::process(const float* in, float* out, int count)
+{
+    for (int i = 0; i < count; i++) {
+        float input = in[i];
+
+        history[history_pos] = input;
+        history_pos = (history_pos + 1) % TRUE_PEAK_TAPS;
+
+        double peak = true_peak();
+        double gain = peak > ceiling ? ceiling / peak : 1.0;
+
+        // Recover slowly, but never slower than the peak needs
+        released_gain = std::min(gain, released_gain + (1.0 - released_gain) * release);
+
+        while (!hold.empty() && hold.back().second >= released_gain) {
+            hold.pop_back();
+        }
+        hold.push_back(std::make_pair(step, released_gain));
+        while (hold.front().first <= step - lookahead) {
+            hold.pop_front();
+        }
+
+        // Every gain averaged here is at most the one the peak needed, so
+        // the peak leaves the delay line at or under the ceiling
+        int slot = step % lookahead;
+        smooth_sum += hold.front().second - smooth[slot];
+        smooth[slot] = hold.front().second;
+
+        delay[delay_pos] = input;
+        delay_pos = (delay_pos + 1) % delay.size();
+        float delayed = delay[delay_pos];
+
+        double limited = delayed * (smooth_sum / lookahead);
+        out[i] = std::max(-ceiling, std::min(ceiling, limited));
+
+        step++;
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+// Samples the true peak detector lags behind its input
+#define TRUE_PEAK_DELAY 4
+
+// Lookahead peak limiter. The peak of each sample, including the
+// inter-sample peaks a DAC would reconstruct (4x oversampled), sets the gain
+// it needs. That gain is held for the lookahead and smoothed over it, so the
+// gain is already down when the peak comes out of the delay line.
+class Limiter
+{
+public:
+    Limiter(double ceiling_db, double lookahead_ms, double release_ms = 50.0);
+    ~Limiter() {}
+
+    // Output lags input by this many samples
+    int latency();
+    void reset();
+    // Streaming: call with consecutive chunks. in and out may be the same.
+    void process(const float* in, float* out, int count);
+
+private:
+    double ceiling;
+    int lookahead;
+    double release;
+
+    // Input history for the true peak interpolator
+    std::vector<double> history;
+    int history_pos;
+
+    double released_gain;
+    // Sliding minimum of the gain over the lookahead: (step, gain) with
+    // gains increasing from front to back
+    std::deque<std::pair<long, double>> hold;
+    // Box filter over the held gain
+    std::vector<double> smooth;
+    double smooth_sum;
+
+    std::vector<float> delay;
+    int delay_pos;
+    long step;
+
+    double true_peak();
+};
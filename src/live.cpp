@@ -0,0 +1,235 @@
+#include "live.h"
+#include "interpreter.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <limits.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+#define CROSSFADE_SAMPLES 1024
+
+struct PlayingVoice {
+    // Declared first so the waves go before the interpreter they came from
+    std::shared_ptr<Interpreter> owner;
+    LiveVoice voice;
+    uint64_t hash;
+    bool hashed;
+
+    // Crossfade gain, ramping towards target
+    float fade;
+    float target;
+};
+
+static bool read_source(const std::string& path, std::string& source)
+{
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    source = buffer.str();
+    return true;
+}
+
+// Carry phase from the old graph's waves to the new one's. The roots always
+// match, other waves match by the global they're bound to.
+static void carry_state(PlayingVoice& from, PlayingVoice& to)
+{
+    std::unordered_map<std::string, std::shared_ptr<Wave>> old_waves;
+    for (std::shared_ptr<Wave> wave : from.voice.graph) {
+        std::string name = from.owner->global_name(wave);
+        if (!name.empty()) {
+            old_waves[name] = wave;
+        }
+    }
+
+    for (std::shared_ptr<Wave> wave : to.voice.graph) {
+        std::shared_ptr<Wave> old;
+        if (wave == to.voice.wave) {
+            old = from.voice.wave;
+        } else {
+            std::string name = to.owner->global_name(wave);
+            if (name.empty() || !old_waves.count(name)) {
+                continue;
+            }
+            old = old_waves[name];
+        }
+
+        wave->phase = old->phase;
+        wave->sample = old->sample;
+    }
+}
+
+// Run the script again and line its voices up against the playing ones
+static void reload(const std::string& source, const ScriptOptions& options,
+    std::vector<PlayingVoice>& playing, int position)
+{
+    std::shared_ptr<Interpreter> interpreter = std::make_shared<Interpreter>();
+    std::vector<LiveVoice> voices;
+
+    try {
+        interpreter->set_oversample(options.oversample);
+        interpreter->collect_voices(&voices);
+        interpreter->interpret(source);
+    } catch (ScriptError& e) {
+        std::cerr << e.what() << "\nKeeping the previous version.\n";
+        return;
+    }
+
+    interpreter->start_voices(voices, position);
+
+    std::vector<PlayingVoice> next;
+    std::vector<bool> kept(playing.size(), false);
+    int unchanged = 0;
+
+    for (LiveVoice& voice : voices) {
+        PlayingVoice added{interpreter, voice, 0, false, 0.f, 1.f};
+        added.hashed = hash_wave_graph(added.voice.wave, added.hash);
+
+        int match = -1;
+        for (int i = 0; i < playing.size(); i++) {
+            if (!kept[i] && playing[i].target > 0 && playing[i].voice.name == voice.name) {
+                match = i;
+                break;
+            }
+        }
+
+        if (match >= 0 && added.hashed && playing[match].hashed && added.hash == playing[match].hash) {
+            // Same graph, let the one already playing carry on
+            kept[match] = true;
+            unchanged++;
+            playing[match].voice.gain = voice.gain;
+            next.push_back(playing[match]);
+            continue;
+        }
+
+        if (match >= 0) {
+            carry_state(playing[match], added);
+        }
+        next.push_back(added);
+    }
+
+    // Everything not carried over fades out
+    for (int i = 0; i < playing.size(); i++) {
+        if (!kept[i]) {
+            playing[i].target = 0.f;
+            next.push_back(playing[i]);
+        }
+    }
+
+    playing.swap(next);
+    std::cerr << "Reloaded, " << voices.size() << " voices (" << unchanged << " unchanged)\n";
+}
+
+int run_watch(const std::string& path, const ScriptOptions& options)
+{
+    // stdout carries the audio, so print() and messages go to stderr
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+    std::string dir = ".";
+    std::string file = path;
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos) {
+        dir = path.substr(0, slash + 1);
+        file = path.substr(slash + 1);
+    }
+
+    // Editors often save by writing a new file and renaming it over the old
+    // one, so watch the directory rather than the file
+    int notify = inotify_init1(IN_NONBLOCK);
+    if (notify < 0 || inotify_add_watch(notify, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "Could not watch " << path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    std::string source;
+    if (!read_source(path, source)) {
+        std::cerr << "Could not open " << path << "\n";
+        return 1;
+    }
+
+    std::vector<PlayingVoice> playing;
+    int position = 0;
+    reload(source, options, playing, position);
+
+    std::vector<float> out(BLOCK_SIZE);
+    char events[sizeof(inotify_event) + NAME_MAX + 1];
+    float step = 1.f / CROSSFADE_SAMPLES;
+
+    while (true) {
+        // Changes are picked up between blocks
+        bool changed = false;
+        ssize_t got;
+        while ((got = read(notify, events, sizeof(events))) > 0) {
+            for (char* p = events; p < events + got; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+                inotify_event* event = (inotify_event*)p;
+                if (event->len > 0 && file == event->name) {
+                    changed = true;
+                }
+            }
+        }
+
+        std::string next_source;
+        if (changed && read_source(path, next_source) && next_source != source) {
+            source = next_source;
+            reload(source, options, playing, position);
+        }
+
+        std::fill(out.begin(), out.end(), 0.f);
+
+        for (int v = 0; v < playing.size(); v++) {
+            PlayingVoice& voice = playing[v];
+            voice.owner->render_voice(voice.voice, position, BLOCK_SIZE);
+
+            std::vector<double>& block = voice.voice.wave->block;
+            for (int i = 0; i < BLOCK_SIZE; i++) {
+                if (voice.fade < voice.target) {
+                    voice.fade = std::min(voice.target, voice.fade + step);
+                } else if (voice.fade > voice.target) {
+                    voice.fade = std::max(voice.target, voice.fade - step);
+                }
+                out[i] += block[i] * voice.voice.gain * voice.fade;
+            }
+        }
+
+        // Drop voices that have finished fading out
+        playing.erase(std::remove_if(playing.begin(), playing.end(), [](PlayingVoice& voice) {
+            return voice.target == 0.f && voice.fade == 0.f;
+        }), playing.end());
+
+        for (float& sample : out) {
+            sample = std::max(-1.f, std::min(1.f, sample));
+        }
+
+        if (fwrite(out.data(), sizeof(float), BLOCK_SIZE, stdout) != BLOCK_SIZE) {
+            break;
+        }
+        fflush(stdout);
+
+        position += BLOCK_SIZE;
+    }
+
+    close(notify);
+    return 0;
+}
+
+#else
+
+// Watches with inotify
+int run_watch(const std::string& path, const ScriptOptions& options)
+{
+    std::cerr << "--watch is not supported on this platform.\n";
+    return 1;
+}
+
+#endif
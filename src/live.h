@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+#include "batch.h"
+
+// az --watch file plays the waves the script writes as raw 32-bit float
+// mono PCM on stdout (e.g. piped into aplay -f FLOAT_LE -r 44100) and
+// reloads the script whenever it's saved. Waves whose graph is unchanged keep
+// playing untouched; changed, new and removed ones are crossfaded in at the
+// next block, with phases carried over from the waves they replace.
+int run_watch(const std::string& path, const ScriptOptions& options);
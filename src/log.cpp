@@ -0,0 +1,77 @@
+#include "log.h"
+
+#include <mutex>
+
+int Azurite::Log::categories = 0;
+LogLevel Azurite::Log::level = LogLevel::Debug;
+
+static std::mutex log_mutex;
+
+static const char* category_name(LogCategory category)
+{
+    switch (category) {
+        case LogCategory::Lexer: return "lexer";
+        case LogCategory::Parser: return "parser";
+        case LogCategory::Interpreter: return "interpreter";
+        case LogCategory::Render: return "render";
+        case LogCategory::Writer: return "writer";
+        default: return "all";
+    }
+}
+
+bool Azurite::Log::enabled(LogLevel msg_level, LogCategory category)
+{
+    return (categories & (int)category) && msg_level <= level;
+}
+
+bool Azurite::Log::enable(std::string category_list)
+{
+    std::stringstream list(category_list);
+    std::string name;
+
+    while (std::getline(list, name, ',')) {
+        if (name == "all") {
+            categories |= (int)LogCategory::All;
+        } else if (name == "lexer") {
+            categories |= (int)LogCategory::Lexer;
+        } else if (name == "parser") {
+            categories |= (int)LogCategory::Parser;
+        } else if (name == "interpreter") {
+            categories |= (int)LogCategory::Interpreter;
+        } else if (name == "render") {
+            categories |= (int)LogCategory::Render;
+        } else if (name == "writer") {
+            categories |= (int)LogCategory::Writer;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Azurite::Log::set_level(std::string level_name)
+{
+    if (level_name == "error") {
+        level = LogLevel::Error;
+    } else if (level_name == "warn") {
+        level = LogLevel::Warn;
+    } else if (level_name == "info") {
+        level = LogLevel::Info;
+    } else if (level_name == "debug") {
+        level = LogLevel::Debug;
+    } else if (level_name == "trace") {
+        level = LogLevel::Trace;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void Azurite::Log::write(LogLevel msg_level, LogCategory category, std::string msg)
+{
+    // Logs go to stderr so they never mix with print() output
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::cerr << "[" << category_name(category) << "] " << msg << '\n';
+}
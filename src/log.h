@@ -0,0 +1,56 @@
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Debug logging. Set AZ_DEBUG_LOG at compile time to build the log calls in,
+// then turn categories on at runtime with --log=parser,render (or --log=all).
+// Without AZ_DEBUG_LOG every AZ_LOG line is removed by the preprocessor.
+
+enum class LogLevel
+{
+    Error,
+    Warn,
+    Info,
+    Debug,
+    Trace
+};
+
+enum class LogCategory
+{
+    Lexer = 1 << 0,
+    Parser = 1 << 1,
+    Interpreter = 1 << 2,
+    Render = 1 << 3,
+    Writer = 1 << 4,
+    All = (1 << 5) - 1
+};
+
+namespace Azurite {
+    namespace Log {
+        extern int categories;
+        extern LogLevel level;
+
+        bool enabled(LogLevel msg_level, LogCategory category);
+        // Parse a comma separated category list such as "parser,render" or "all"
+        bool enable(std::string category_list);
+        bool set_level(std::string level_name);
+        void write(LogLevel msg_level, LogCategory category, std::string msg);
+    }
+}
+
+#ifdef AZ_DEBUG_LOG
+#define AZ_LOG_ENABLED 1
+#define AZ_LOG(level, category, message) \
+    do { \
+        if (Azurite::Log::enabled(LogLevel::level, LogCategory::category)) { \
+            std::ostringstream az_log_stream; \
+            az_log_stream << message; \
+            Azurite::Log::write(LogLevel::level, LogCategory::category, az_log_stream.str()); \
+        } \
+    } while (0)
+#else
+#define AZ_LOG_ENABLED 0
+#define AZ_LOG(level, category, message) do {} while (0)
+#endif
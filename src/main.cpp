@@ -2,6 +2,12 @@
 #include <sstream>
 
 #include "interpreter.h"
+#include "batch.h"
+#include "server.h"
+#include "live.h"
+#include "log.h"
+#include "random.h"
+#include "stats.h"
 
 int main(int argc, char* argv[]) {
     // std::string src = "notes = ([0,2,3,5,7,10])\n"
@@ -20,12 +26,90 @@ int main(int argc, char* argv[]) {
     "print(50)\n"
     "}";
 
-    // Read source file (first command line argument)
-    std::ifstream source_file(argv[1]);
-    std::stringstream buffer;
-    buffer << source_file.rdbuf();
+    std::vector<std::string> paths;
+    std::string manifest;
+    std::string socket_path;
+    bool batch = false;
+    bool watch = false;
+    ScriptOptions options;
+    options.threads = ThreadPool::default_threads();
 
-    Interpreter interpreter;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
 
-    interpreter.interpret(buffer.str());
-}
\ No newline at end of file
+        if (arg.rfind("--log=", 0) == 0) {
+            if (!Azurite::Log::enable(arg.substr(6))) {
+                std::cout << "Unknown log category in " << arg << "\n";
+                return 1;
+            }
+#if !AZ_LOG_ENABLED
+            std::cout << "Logging was not compiled in, rebuild with AZ_DEBUG_LOG.\n";
+#endif
+        } else if (arg.rfind("--log-level=", 0) == 0) {
+            if (!Azurite::Log::set_level(arg.substr(12))) {
+                std::cout << "Unknown log level in " << arg << "\n";
+                return 1;
+            }
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            options.threads = std::atoi(arg.substr(10).c_str());
+        } else if (arg.rfind("--oversample=", 0) == 0) {
+            options.oversample = std::atoi(arg.substr(13).c_str());
+            if (!Interpreter::valid_oversample(options.oversample)) {
+                std::cout << "Oversampling factor must be 1, 2, 4 or 8.\n";
+                return 1;
+            }
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            Azurite::set_random_seed(std::strtoull(arg.substr(7).c_str(), nullptr, 10));
+        } else if (arg == "--stats") {
+            Azurite::Stats::enabled = true;
+        } else if (arg == "--no-cache") {
+            options.use_cache = false;
+        } else if (arg == "--incremental") {
+            options.incremental = true;
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg.rfind("--manifest=", 0) == 0) {
+            manifest = arg.substr(11);
+            batch = true;
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg.rfind("--serve=", 0) == 0) {
+            socket_path = arg.substr(8);
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (!manifest.empty() && !read_manifest(manifest, paths)) {
+        return 1;
+    }
+
+    if (!socket_path.empty()) {
+        return run_server(socket_path, options, options.threads);
+    }
+
+    if (paths.empty() || (!batch && paths.size() > 1) || (batch && watch)) {
+        std::cout << "Usage: az [options] file\n"
+            "       az [options] --batch files...\n"
+            "       az [options] --manifest=list\n"
+            "       az [options] --serve=socket\n"
+            "       az [options] --watch file > pcm\n"
+            "Options: --threads=n --oversample=n --seed=n --incremental --no-cache --stats --log=categories --log-level=level\n";
+        return 1;
+    }
+
+    int status;
+    if (watch) {
+        status = run_watch(paths[0], options);
+    } else if (batch) {
+        status = run_batch(paths, options, options.threads) > 0 ? 1 : 0;
+    } else {
+        status = run_script(paths[0], options) ? 0 : 1;
+    }
+
+    // On stderr, out of the way of print() and PCM on stdout
+    if (Azurite::Stats::enabled) {
+        Azurite::Stats::report(std::cerr);
+    }
+    return status;
+}
@@ -0,0 +1,45 @@
+#include "noise.h"
+#include "hash.h"
+
+#include <algorithm>
+
+NoiseProcessor::NoiseProcessor(NoiseColor color, uint64_t stream_seed)
+    : color(color), stream_seed(stream_seed)
+{
+    reset();
+}
+
+void NoiseProcessor::reset()
+{
+    random.seed(stream_seed);
+    std::fill(b, b + 7, 0.0);
+}
+
+void NoiseProcessor::process(std::vector<double>& out, int start, int count)
+{
+    random.fill(out.data(), count);
+
+    if (color == NoiseColor::White) {
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        double white = out[i];
+        b[0] = 0.99886 * b[0] + white * 0.0555179;
+        b[1] = 0.99332 * b[1] + white * 0.0750759;
+        b[2] = 0.96900 * b[2] + white * 0.1538520;
+        b[3] = 0.86650 * b[3] + white * 0.3104856;
+        b[4] = 0.55000 * b[4] + white * 0.5329522;
+        b[5] = -0.7616 * b[5] - white * 0.0168980;
+        out[i] = (b[0] + b[1] + b[2] + b[3] + b[4] + b[5] + b[6] + white * 0.5362) * 0.11;
+        b[6] = white * 0.115926;
+    }
+}
+
+bool NoiseProcessor::hash(uint64_t& hash)
+{
+    hash = hash_string("noise", hash);
+    hash = hash_value(color, hash);
+    hash = hash_value(stream_seed, hash);
+    return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "processor.h"
+#include "random.h"
+
+enum class NoiseColor
+{
+    White,
+    Pink
+};
+
+
+// noise(color). White noise is uniform in [-1, 1); pink is that run
+// through Paul Kellet's refined filter, scaled to about the same peak.
+class NoiseProcessor : public WaveProcessor
+{
+public:
+    NoiseProcessor(NoiseColor color, uint64_t stream_seed);
+    ~NoiseProcessor() {}
+
+    void reset();
+    void process(std::vector<double>& out, int start, int count);
+    bool hash(uint64_t& hash);
+
+private:
+    NoiseColor color;
+    uint64_t stream_seed;
+    BlockRandom random;
+    double b[7];
+};
@@ -0,0 +1,343 @@
+#include "oscillator.h"
+#include "exprreduction.h"
+
+#include <cmath>
+
+#define TAU 6.28318530717958647692
+
+enum class Match { Fail, Operand, Chain };
+
+// An operand is a constant (signal == nullptr) or a wave read with nothing
+// applied to it yet
+struct KernelOperand {
+    double value;
+    Wave* signal;
+};
+
+static double apply_op(KernelOp op, double lhs, double rhs)
+{
+    switch (op) {
+        case KernelOp::Add: return lhs + rhs;
+        case KernelOp::Sub: return lhs - rhs;
+        case KernelOp::Mul: return lhs * rhs;
+        case KernelOp::Div: return lhs / rhs;
+        case KernelOp::Mod: return fmod(lhs, rhs);
+        case KernelOp::Pow: return pow(lhs, rhs);
+        case KernelOp::Neg: return -lhs;
+        case KernelOp::Sin: return std::sin(lhs);
+        case KernelOp::Abs: return std::abs(lhs);
+        case KernelOp::Floor: return std::floor(lhs);
+        default: return lhs;
+    }
+}
+
+static inline double apply_step(const KernelStep& step, double value, int i)
+{
+    double operand = step.signal != nullptr ? step.signal->block[i] : step.value;
+    if (step.operand_left) {
+        return apply_op(step.op, operand, value);
+    }
+    return apply_op(step.op, value, operand);
+}
+
+static inline double apply_steps(const std::vector<KernelStep>& steps, double value, int i)
+{
+    for (const KernelStep& step : steps) {
+        value = apply_step(step, value, i);
+    }
+    return value;
+}
+
+static inline double eval_chain(const KernelChain& chain, double x, int i)
+{
+    switch (chain.core) {
+        case KernelChain::Core::Constant:
+            return chain.value;
+        case KernelChain::Core::X:
+            return apply_steps(chain.steps, x, i);
+        default:
+            return apply_steps(chain.steps, chain.signal->block[i], i);
+    }
+}
+
+static bool binary_op(const Token& op, KernelOp& out)
+{
+    if (op.type != TokenType::ArithmeticOperator) {
+        // Comparisons give Bools, which can't be wave samples
+        return false;
+    }
+    if (op.value == "+") out = KernelOp::Add;
+    else if (op.value == "-") out = KernelOp::Sub;
+    else if (op.value == "*") out = KernelOp::Mul;
+    else if (op.value == "/") out = KernelOp::Div;
+    else if (op.value == "%") out = KernelOp::Mod;
+    else if (op.value == "^") out = KernelOp::Pow;
+    else return false;
+    return true;
+}
+
+static void start_signal_chain(KernelChain& chain, Wave* signal)
+{
+    chain.core = KernelChain::Core::Signal;
+    chain.signal = signal;
+    chain.steps.clear();
+}
+
+static Match match(Expr* node, KernelChain& chain, KernelOperand& operand);
+
+// Applies op to a chain and an operand, folding constants and turning a
+// bare wave read into a chain when it meets one
+static Match combine(KernelOp op, Match lhs, KernelChain& lhs_chain, KernelOperand& lhs_operand,
+    Match rhs, KernelChain& rhs_chain, KernelOperand& rhs_operand, KernelChain& chain, KernelOperand& operand)
+{
+    if (lhs == Match::Fail || rhs == Match::Fail || (lhs == Match::Chain && rhs == Match::Chain)) {
+        return Match::Fail;
+    }
+
+    if (lhs == Match::Operand && rhs == Match::Operand) {
+        if (lhs_operand.signal == nullptr && rhs_operand.signal == nullptr) {
+            operand.value = apply_op(op, lhs_operand.value, rhs_operand.value);
+            operand.signal = nullptr;
+            return Match::Operand;
+        }
+        // The first wave read becomes the chain's core
+        if (lhs_operand.signal != nullptr) {
+            start_signal_chain(lhs_chain, lhs_operand.signal);
+            lhs = Match::Chain;
+        } else {
+            start_signal_chain(rhs_chain, rhs_operand.signal);
+            rhs = Match::Chain;
+        }
+    }
+
+    bool chain_left = lhs == Match::Chain;
+    chain = chain_left ? lhs_chain : rhs_chain;
+    KernelOperand& other = chain_left ? rhs_operand : lhs_operand;
+    chain.steps.push_back(KernelStep{op, other.value, other.signal, !chain_left});
+    return Match::Chain;
+}
+
+static Match match(Expr* node, KernelChain& chain, KernelOperand& operand)
+{
+    switch (node->type) {
+        case NodeType::NumberPointerNode:
+            // Always the wave's own x
+            chain.core = KernelChain::Core::X;
+            chain.steps.clear();
+            return Match::Chain;
+        case NodeType::NumericLiteral:
+            operand.value = ((NumericLiteral*)node)->value;
+            operand.signal = nullptr;
+            return Match::Operand;
+        case NodeType::RuntimeValPointerNode: {
+            std::shared_ptr<RuntimeVal> value = ((RuntimeValPointerNode*)node)->value;
+            if (value->type == RuntimeType::Number) {
+                operand.value = std::static_pointer_cast<Number>(value)->value;
+                operand.signal = nullptr;
+                return Match::Operand;
+            }
+            if (value->type == RuntimeType::Wave) {
+                operand.value = 0.0;
+                operand.signal = (Wave*)value.get();
+                return Match::Operand;
+            }
+            return Match::Fail;
+        }
+        case NodeType::UnaryExpr: {
+            UnaryExpr* dnode = (UnaryExpr*)node;
+            if (dnode->op.type != TokenType::ArithmeticOperator) {
+                return Match::Fail;
+            }
+            Match result = match(dnode->operand, chain, operand);
+            if (result == Match::Fail || dnode->op.value == "+") {
+                return result;
+            }
+            if (dnode->op.value != "-") {
+                return Match::Fail;
+            }
+            if (result == Match::Operand && operand.signal == nullptr) {
+                operand.value = -operand.value;
+                return Match::Operand;
+            }
+            if (result == Match::Operand) {
+                start_signal_chain(chain, operand.signal);
+            }
+            chain.steps.push_back(KernelStep{KernelOp::Neg, 0.0, nullptr, false});
+            return Match::Chain;
+        }
+        case NodeType::BinaryExpr: {
+            BinaryExpr* dnode = (BinaryExpr*)node;
+            KernelOp op;
+            if (!binary_op(dnode->op, op)) {
+                return Match::Fail;
+            }
+            KernelChain lhs_chain, rhs_chain;
+            KernelOperand lhs_operand, rhs_operand;
+            Match lhs = match(dnode->lhs, lhs_chain, lhs_operand);
+            Match rhs = match(dnode->rhs, rhs_chain, rhs_operand);
+            return combine(op, lhs, lhs_chain, lhs_operand, rhs, rhs_chain, rhs_operand, chain, operand);
+        }
+        case NodeType::CallExpr: {
+            CallExpr* dnode = (CallExpr*)node;
+            KernelOp op;
+            if (dnode->callee->name == "sin") op = KernelOp::Sin;
+            else if (dnode->callee->name == "abs") op = KernelOp::Abs;
+            else if (dnode->callee->name == "floor") op = KernelOp::Floor;
+            else return Match::Fail;
+
+            if (dnode->arguments->arguments.size() != 1) {
+                return Match::Fail;
+            }
+            Match result = match(dnode->arguments->arguments[0], chain, operand);
+            if (result == Match::Fail) {
+                return result;
+            }
+            if (result == Match::Operand && operand.signal == nullptr) {
+                operand.value = apply_op(op, operand.value, 0.0);
+                return Match::Operand;
+            }
+            if (result == Match::Operand) {
+                start_signal_chain(chain, operand.signal);
+            }
+            chain.steps.push_back(KernelStep{op, 0.0, nullptr, false});
+            return Match::Chain;
+        }
+        default:
+            return Match::Fail;
+    }
+}
+
+static bool match_chain(Expr* node, KernelChain& chain)
+{
+    KernelOperand operand;
+    Match result = match(node, chain, operand);
+
+    if (result == Match::Operand && operand.signal == nullptr) {
+        chain.core = KernelChain::Core::Constant;
+        chain.value = operand.value;
+        chain.steps.clear();
+    } else if (result == Match::Operand) {
+        start_signal_chain(chain, operand.signal);
+    }
+    return result != Match::Fail;
+}
+
+// The function a waveform is built around
+struct IdentityShape { static double apply(double v) { return v; } };
+struct SineShape { static double apply(double v) { return std::sin(v); } };
+struct AbsShape { static double apply(double v) { return std::abs(v); } };
+struct FloorShape { static double apply(double v) { return std::floor(v); } };
+
+// Mirrors Interpreter::get_sample_and_advance for a wave at 1x. Params that
+// don't vary are evaluated once instead of per sample.
+template <class Shape, bool ModFreq, bool ModPhase, bool ModVol>
+static void render_shape(OscillatorKernel& k, Wave* wave, int start, int count)
+{
+    double freq = k.freq.value;
+    double phase_offset = k.phase.value;
+    double vol = k.vol.value;
+    double* out = wave->block.data();
+
+    for (int i = 0; i < count; i++) {
+        int global_sample = start + i;
+
+        if (ModFreq) freq = eval_chain(k.freq, global_sample, i);
+        if (ModPhase) phase_offset = eval_chain(k.phase, global_sample, i);
+        if (ModVol) vol = eval_chain(k.vol, global_sample, i);
+
+        wave->x = wave->phase + phase_offset;
+        double height = eval_chain(k.inner, wave->x, i);
+        height = apply_steps(k.outer, Shape::apply(height), i);
+
+        out[i] = height * vol;
+
+        if (global_sample >= wave->sample) {
+            wave->sample++;
+            wave->phase += TAU * (freq) / 44100;
+        }
+    }
+
+    Wave::global_sample = start + count - 1;
+}
+
+template <class Shape>
+static void (*select_kernel(bool mod_freq, bool mod_phase, bool mod_vol))(OscillatorKernel&, Wave*, int, int)
+{
+    static void (*const kernels[8])(OscillatorKernel&, Wave*, int, int) = {
+        render_shape<Shape, false, false, false>, render_shape<Shape, false, false, true>,
+        render_shape<Shape, false, true, false>, render_shape<Shape, false, true, true>,
+        render_shape<Shape, true, false, false>, render_shape<Shape, true, false, true>,
+        render_shape<Shape, true, true, false>, render_shape<Shape, true, true, true>,
+    };
+    return kernels[mod_freq * 4 + mod_phase * 2 + mod_vol];
+}
+
+OscillatorKernel* OscillatorKernel::recognize(Wave* wave)
+{
+    if (wave->processor != nullptr || wave->decimator != nullptr || wave->fast_wave_expr == nullptr) {
+        return nullptr;
+    }
+
+    OscillatorKernel* k = new OscillatorKernel();
+    KernelChain waveform;
+
+    if (!match_chain(wave->fast_freq_expr, k->freq)
+            || !match_chain(wave->fast_phase_expr, k->phase)
+            || !match_chain(wave->fast_vol_expr, k->vol)
+            || !match_chain(wave->fast_wave_expr, waveform)) {
+        delete k;
+        return nullptr;
+    }
+
+    // Split the waveform at its first function
+    k->inner = waveform;
+    k->inner.steps.clear();
+    k->shape = KernelOp::Identity;
+    for (KernelStep& step : waveform.steps) {
+        if (k->shape == KernelOp::Identity
+                && (step.op == KernelOp::Sin || step.op == KernelOp::Abs || step.op == KernelOp::Floor)) {
+            k->shape = step.op;
+        } else if (k->shape == KernelOp::Identity) {
+            k->inner.steps.push_back(step);
+        } else {
+            k->outer.push_back(step);
+        }
+    }
+
+    bool mod_freq = k->freq.core != KernelChain::Core::Constant;
+    bool mod_phase = k->phase.core != KernelChain::Core::Constant;
+    bool mod_vol = k->vol.core != KernelChain::Core::Constant;
+
+    switch (k->shape) {
+        case KernelOp::Sin: k->kernel = select_kernel<SineShape>(mod_freq, mod_phase, mod_vol); break;
+        case KernelOp::Abs: k->kernel = select_kernel<AbsShape>(mod_freq, mod_phase, mod_vol); break;
+        case KernelOp::Floor: k->kernel = select_kernel<FloorShape>(mod_freq, mod_phase, mod_vol); break;
+        default: k->kernel = select_kernel<IdentityShape>(mod_freq, mod_phase, mod_vol); break;
+    }
+
+    return k;
+}
+
+std::string OscillatorKernel::describe()
+{
+    std::string name;
+    switch (shape) {
+        case KernelOp::Sin: name = "sine"; break;
+        case KernelOp::Abs: name = "triangle"; break;
+        case KernelOp::Floor: name = "square"; break;
+        default: {
+            name = "ramp";
+            for (KernelStep& step : inner.steps) {
+                if (step.op == KernelOp::Mod) name = "saw";
+            }
+        }
+    }
+
+    if (freq.core != KernelChain::Core::Constant || phase.core != KernelChain::Core::Constant) {
+        name += " FM";
+    }
+    if (vol.core != KernelChain::Core::Constant) {
+        name += " AM";
+    }
+    return name;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "runtimeval.h"
+
+// Operations a kernel chain can apply to its running value
+enum class KernelOp {
+    Add, Sub, Mul, Div, Mod, Pow,
+    Neg, Sin, Abs, Floor,
+    // Only as a kernel's shape: a waveform with no function in it
+    Identity
+};
+
+// One step of a chain. Binary ops take a constant or the current sample of
+// another wave, on whichever side it was written.
+struct KernelStep {
+    KernelOp op;
+    double value;
+    Wave* signal;
+    bool operand_left;
+};
+
+// An expression with a single varying input (x, or another wave) that the
+// rest of the tree is applied to one op at a time, in the order the tree
+// would have evaluated them
+struct KernelChain {
+    enum class Core { Constant, X, Signal };
+
+    Core core;
+    double value;
+    Wave* signal;
+    std::vector<KernelStep> steps;
+};
+
+
+// Tight per-block loop for waves whose expressions reduce to chains:
+// sines, saws from %, triangles from abs and squares from floor, with
+// frequency, phase and volume that are constant or follow another wave (FM,
+// PM and AM). Evaluates the same ops in the same order as the expression
+// tree, so the output is identical to the generic path.
+class OscillatorKernel
+{
+public:
+    // nullptr if the wave's simplified expressions don't fit. The wave
+    // must not be oversampled or a processor.
+    static OscillatorKernel* recognize(Wave* wave);
+
+    void render(Wave* wave, int start, int count) { kernel(*this, wave, start, count); }
+    // e.g. "sine FM", for logging
+    std::string describe();
+
+    KernelChain freq;
+    KernelChain phase;
+    KernelChain vol;
+    // Waveform steps before its first function, the function the kernel is
+    // specialised on, and the steps after it
+    KernelChain inner;
+    KernelOp shape;
+    std::vector<KernelStep> outer;
+
+private:
+    typedef void (*KernelFunc)(OscillatorKernel& k, Wave* wave, int start, int count);
+    KernelFunc kernel;
+};
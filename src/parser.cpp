@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "stats.h"
 
 // Get token at cursor
 Token Parser::at()
@@ -24,15 +25,14 @@ Token Parser::expect(TokenType type, std::string msg)
 
 void Parser::syntax_error(std::string msg)
 {
-    std::cout << "Syntax error: " << msg;
-    std::cout << " Line " << at().line << ", col " << at().col << std::endl;
-    exit(1);
+    throw ScriptError("Syntax error: " + msg
+        + " Line " + std::to_string(at().line) + ", col " + std::to_string(at().col));
 }
 
 // Advance to first non-endline token
 void Parser::skip_whitespace()
 {
-    std::cout << "skipping whitespace\n";
+    AZ_LOG(Trace, Parser, "skipping whitespace");
     while (at().type == TokenType::Endline) {
         eat();
     }
@@ -47,12 +47,18 @@ Token Parser::peek()
 
 Program* Parser::parse(std::string source)
 {
+    Azurite::Stats::PhaseTimer parse_timer(StatsPhase::Parse);
     ptr = 0;
-    tokens = lexer.tokenize(source);
+    {
+        Azurite::Stats::PhaseTimer lex_timer(StatsPhase::Lex);
+        tokens = lexer.tokenize(source);
+    }
 
+#if AZ_LOG_ENABLED
     for (Token token : tokens) {
-        std::cout << token.value << ",\n";
+        AZ_LOG(Trace, Parser, token.value << ",");
     }
+#endif
 
     Token begin = at();
     Stmts* body = parse_stmts();
@@ -65,10 +71,10 @@ Stmts* Parser::parse_stmts()
     Token begin = at();
     std::vector<Stmt*> stmts;
 
-    std::cout << "parsing stmts\n";
+    AZ_LOG(Trace, Parser, "parsing stmts");
 
     while (at().type != TokenType::EndOfFile && at().type != TokenType::CloseBrace) {
-        std::cout << "adding stmts, token is: \"" << at().value << "\"\n";
+        AZ_LOG(Trace, Parser, "adding stmts, token is: \"" << at().value << "\"");
         stmts.push_back(parse_stmt());
     }
 
@@ -96,7 +102,7 @@ Stmt* Parser::parse_stmt()
 {
     skip_whitespace();
 
-    std::cout << "parsing stmt\n";
+    AZ_LOG(Trace, Parser, "parsing stmt");
 
     Stmt* result;
 
@@ -131,7 +137,7 @@ AssignStmt* Parser::parse_assignstmt()
 
     Expr* lhs = parse_memberexpr();
 
-    std::cout << "parsing assignexpr\n";
+    AZ_LOG(Trace, Parser, "parsing assignexpr");
 
     expect(TokenType::Equals, "Expected '='.");
 
@@ -277,7 +283,7 @@ Arguments* Parser::parse_arguments()
 
 Expr* Parser::parse_expr()
 {
-    std::cout << "parsing expr\n";
+    AZ_LOG(Trace, Parser, "parsing expr");
 
     return parse_or();
 }
@@ -383,7 +389,7 @@ Expr* Parser::parse_primaryexpr()
 {
     Token begin = at();
 
-    std::cout << "parsing primary\n";
+    AZ_LOG(Trace, Parser, "parsing primary");
 
     if (at().type == TokenType::Number) {
         return new NumericLiteral(std::stod(eat().value), begin);
@@ -493,6 +499,8 @@ WaveDeclaration* Parser::parse_wavedeclaration()
     Expr* phase_expr = default_phase;
     Expr* vol_expr = default_vol;
     Expr* pan_expr = default_pan;
+    Expr* oversample_expr = nullptr;
+    Expr* active_expr = nullptr;
 
     while (at().type == TokenType::Identifier) {
         std::string type = eat().value;
@@ -516,6 +524,12 @@ WaveDeclaration* Parser::parse_wavedeclaration()
         } else if (type == "pan") {
             delete pan_expr;
             pan_expr = function_expr;
+        } else if (type == "oversample") {
+            delete oversample_expr;
+            oversample_expr = function_expr;
+        } else if (type == "active") {
+            delete active_expr;
+            active_expr = function_expr;
         } else {
             syntax_error("Unrecognized wave function specifier.");
         }
@@ -528,6 +542,6 @@ WaveDeclaration* Parser::parse_wavedeclaration()
 
     expect(TokenType::CloseParen, "Expected ')'.");
 
-    return new WaveDeclaration(wave_expr, freq_expr, phase_expr, vol_expr, pan_expr, begin);
+    return new WaveDeclaration(wave_expr, freq_expr, phase_expr, vol_expr, pan_expr, oversample_expr, active_expr, begin);
 }
 
@@ -6,6 +6,7 @@
 
 #include "ast.h"
 #include "lexer.h"
+#include "log.h"
 
 class Parser
 {
@@ -25,7 +26,7 @@ private:
     Token at();
     Token eat();
     Token expect(TokenType type, std::string msg);
-    void syntax_error(std::string msg);
+    [[noreturn]] void syntax_error(std::string msg);
     void skip_whitespace();
     Token peek();
 
@@ -0,0 +1,119 @@
+#include "processor.h"
+#include "wavegraph.h"
+#include "hash.h"
+
+#include <algorithm>
+
+ProcessorParam::ProcessorParam(double value)
+    : value(value) {}
+
+ProcessorParam::ProcessorParam(std::shared_ptr<Wave> wave)
+    : value(0.0), wave(wave) {}
+
+void ProcessorParam::hash(uint64_t& hash)
+{
+    // The wave itself is hashed as one of the processor's inputs
+    hash = hash_value(modulated(), hash);
+    if (!modulated()) {
+        hash = hash_value(value, hash);
+    }
+}
+
+void WaveProcessor::add_param(ProcessorParam& param)
+{
+    if (param.modulated()) {
+        inputs.push_back(param.wave);
+    }
+}
+
+void WaveProcessor::replace_input(Wave* input, std::shared_ptr<Wave> replacement)
+{
+    for (std::shared_ptr<Wave>& wave : inputs) {
+        if (wave.get() == input) {
+            wave = replacement;
+        }
+    }
+}
+
+ConvolveProcessor::ConvolveProcessor(std::shared_ptr<Wave> input, std::vector<double> impulse)
+    : impulse(impulse), convolver(impulse, BLOCK_SIZE), in(BLOCK_SIZE)
+{
+    inputs.push_back(input);
+}
+
+void ConvolveProcessor::reset()
+{
+    convolver.reset();
+}
+
+void ConvolveProcessor::process(std::vector<double>& out, int start, int count)
+{
+    // Renders run in whole blocks, only the very last one can be short, so
+    // padding it with silence doesn't disturb anything after it
+    const std::vector<double>& source = inputs[0]->block;
+    std::copy(source.begin(), source.begin() + count, in.begin());
+    std::fill(in.begin() + count, in.end(), 0.0);
+
+    convolver.process(in.data(), out.data());
+}
+
+bool ConvolveProcessor::hash(uint64_t& hash)
+{
+    hash = hash_string("convolve", hash);
+    hash = hash_value(impulse.size(), hash);
+    hash = hash_bytes(impulse.data(), impulse.size() * sizeof(double), hash);
+    return true;
+}
+
+DelayProcessor::DelayProcessor(std::shared_ptr<Wave> input, int samples)
+    : samples(samples), history(samples), position(0)
+{
+    inputs.push_back(input);
+}
+
+void DelayProcessor::reset()
+{
+    std::fill(history.begin(), history.end(), 0.0);
+    position = 0;
+}
+
+void DelayProcessor::process(std::vector<double>& out, int start, int count)
+{
+    const std::vector<double>& source = inputs[0]->block;
+    for (int i = 0; i < count; i++) {
+        out[i] = history[position];
+        history[position] = source[i];
+        position = position + 1 < samples ? position + 1 : 0;
+    }
+}
+
+bool DelayProcessor::hash(uint64_t& hash)
+{
+    hash = hash_string("delay", hash);
+    hash = hash_value(samples, hash);
+    return true;
+}
+
+std::vector<float> convolve_samples(const std::vector<float>& input, const std::vector<double>& impulse)
+{
+    Convolver convolver(impulse, BLOCK_SIZE);
+
+    int length = input.size() + impulse.size() - 1;
+    std::vector<float> output(std::max(length, 0));
+    std::vector<double> in(BLOCK_SIZE);
+    std::vector<double> out(BLOCK_SIZE);
+
+    for (int start = 0; start < length; start += BLOCK_SIZE) {
+        for (int i = 0; i < BLOCK_SIZE; i++) {
+            in[i] = start + i < input.size() ? input[start + i] : 0.0;
+        }
+
+        convolver.process(in.data(), out.data());
+
+        for (int i = 0; i < BLOCK_SIZE && start + i < length; i++) {
+            output[start + i] = out[i];
+        }
+    }
+
+    return output;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "runtimeval.h"
+#include "convolver.h"
+
+#define SAMPLE_RATE 44100
+
+
+// A processor setting that is either a constant or another wave, read
+// sample by sample from that wave's block
+class ProcessorParam
+{
+public:
+    double value;
+    std::shared_ptr<Wave> wave;
+
+    ProcessorParam(double value = 0.0);
+    ProcessorParam(std::shared_ptr<Wave> wave);
+
+    double at(int i) { return wave != nullptr ? wave->block[i] : value; }
+    bool modulated() { return wave != nullptr; }
+    void hash(uint64_t& hash);
+};
+
+
+// Native DSP behind a Wave. Instead of evaluating expressions per sample,
+// a processor wave fills its whole block at once from the blocks of its
+// input waves, which the wave graph renders first.
+class WaveProcessor
+{
+public:
+    std::vector<std::shared_ptr<Wave>> inputs;
+
+    // Modulated params read a wave, which then has to render first
+    void add_param(ProcessorParam& param);
+    // Read replacement wherever input was read (see compensate_latency)
+    virtual void replace_input(Wave* input, std::shared_ptr<Wave> replacement);
+
+    virtual ~WaveProcessor() {}
+
+    // Called before rendering from the first sample
+    virtual void reset() = 0;
+    // Write count samples, starting at global sample start, into out
+    virtual void process(std::vector<double>& out, int start, int count) = 0;
+    // Settings that affect the output (not the inputs, those are hashed as
+    // waves). Return false if the output can't be cached.
+    virtual bool hash(uint64_t& hash) = 0;
+    // True if the output only depends on the sample position and inputs, so
+    // a render can pick up from anywhere without replaying earlier blocks
+    virtual bool stateless() { return false; }
+    // True if the output changes slowly and without jumps, so waves can
+    // read it at control rate
+    virtual bool smooth() { return false; }
+    // False if rendering calls back into the interpreter for expressions
+    // that aren't pure (see is_pure_wave)
+    virtual bool pure() { return true; }
+    // Narrow start and end down to where the output can be non-zero
+    virtual void span(int& start, int& end) {}
+};
+
+
+// convolve(wave, impulse)
+class ConvolveProcessor : public WaveProcessor
+{
+public:
+    ConvolveProcessor(std::shared_ptr<Wave> input, std::vector<double> impulse);
+    ~ConvolveProcessor() {}
+
+    void reset();
+    void process(std::vector<double>& out, int start, int count);
+    bool hash(uint64_t& hash);
+
+private:
+    std::vector<double> impulse;
+    Convolver convolver;
+    std::vector<double> in;
+};
+
+// Its input, samples samples late. Not a built-in: prepare puts these in
+// front of inputs that would otherwise arrive ahead of a wave's others.
+class DelayProcessor : public WaveProcessor
+{
+public:
+    DelayProcessor(std::shared_ptr<Wave> input, int samples);
+    ~DelayProcessor() {}
+
+    void reset();
+    void process(std::vector<double>& out, int start, int count);
+    bool hash(uint64_t& hash);
+
+private:
+    int samples;
+    // The last samples inputs, oldest at position
+    std::vector<double> history;
+    int position;
+};
+
+// Whole-buffer version of convolve, the result is input + impulse - 1 long
+std::vector<float> convolve_samples(const std::vector<float>& input, const std::vector<double>& impulse);
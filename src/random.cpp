@@ -0,0 +1,175 @@
+#include "random.h"
+
+#include <cstring>
+#include <random>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static uint64_t splitmix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// Top 52 bits as the mantissa of a double in [1, 2)
+static inline double to_unit_interval(uint64_t bits)
+{
+    bits = (bits >> 12) | 0x3ff0000000000000ULL;
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+Random::Random(uint64_t seed)
+{
+    this->seed(seed);
+}
+
+void Random::seed(uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        s[i] = splitmix64(seed);
+    }
+}
+
+uint64_t Random::next()
+{
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+double Random::next_double()
+{
+    return to_unit_interval(next()) - 1.0;
+}
+
+BlockRandom::BlockRandom(uint64_t seed)
+{
+    this->seed(seed);
+}
+
+void BlockRandom::seed(uint64_t seed)
+{
+    for (int lane = 0; lane < 2; lane++) {
+        for (int i = 0; i < 4; i++) {
+            s[i][lane] = splitmix64(seed);
+        }
+    }
+}
+
+void BlockRandom::fill(double* out, int n)
+{
+#ifdef __SSE2__
+    __m128i s0 = _mm_load_si128((__m128i*)s[0]);
+    __m128i s1 = _mm_load_si128((__m128i*)s[1]);
+    __m128i s2 = _mm_load_si128((__m128i*)s[2]);
+    __m128i s3 = _mm_load_si128((__m128i*)s[3]);
+    const __m128i exponent = _mm_set1_epi64x(0x3ff0000000000000LL);
+    const __m128d two = _mm_set1_pd(2.0);
+    const __m128d three = _mm_set1_pd(3.0);
+
+    for (int i = 0; i < n; i += 2) {
+        // rotl(s1 * 5, 7) * 9, multiplies as shift and add
+        __m128i r = _mm_add_epi64(_mm_slli_epi64(s1, 2), s1);
+        r = _mm_or_si128(_mm_slli_epi64(r, 7), _mm_srli_epi64(r, 57));
+        r = _mm_add_epi64(_mm_slli_epi64(r, 3), r);
+
+        __m128i t = _mm_slli_epi64(s1, 17);
+        s2 = _mm_xor_si128(s2, s0);
+        s3 = _mm_xor_si128(s3, s1);
+        s1 = _mm_xor_si128(s1, s2);
+        s0 = _mm_xor_si128(s0, s3);
+        s2 = _mm_xor_si128(s2, t);
+        s3 = _mm_or_si128(_mm_slli_epi64(s3, 45), _mm_srli_epi64(s3, 19));
+
+        // [1, 2) -> [-1, 1)
+        __m128d value = _mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(r, 12), exponent));
+        value = _mm_sub_pd(_mm_mul_pd(value, two), three);
+
+        if (i + 1 < n) {
+            _mm_storeu_pd(out + i, value);
+        } else {
+            _mm_store_sd(out + i, value);
+        }
+    }
+
+    _mm_store_si128((__m128i*)s[0], s0);
+    _mm_store_si128((__m128i*)s[1], s1);
+    _mm_store_si128((__m128i*)s[2], s2);
+    _mm_store_si128((__m128i*)s[3], s3);
+#else
+    for (int i = 0; i < n; i += 2) {
+        for (int lane = 0; lane < 2; lane++) {
+            uint64_t result = rotl(s[1][lane] * 5, 7) * 9;
+            uint64_t t = s[1][lane] << 17;
+
+            s[2][lane] ^= s[0][lane];
+            s[3][lane] ^= s[1][lane];
+            s[1][lane] ^= s[2][lane];
+            s[0][lane] ^= s[3][lane];
+            s[2][lane] ^= t;
+            s[3][lane] = rotl(s[3][lane], 45);
+
+            if (i + lane < n) {
+                out[i + lane] = to_unit_interval(result) * 2.0 - 3.0;
+            }
+        }
+    }
+#endif
+}
+
+static uint64_t run_seed = std::random_device()() * 0x100000001ULL ^ std::random_device()();
+static thread_local uint64_t stream_index = 0;
+static thread_local Random script_random;
+static thread_local Random* current = nullptr;
+
+void Azurite::set_random_seed(uint64_t seed)
+{
+    run_seed = seed;
+}
+
+uint64_t Azurite::random_seed()
+{
+    return run_seed;
+}
+
+void Azurite::reset_random_streams()
+{
+    stream_index = 0;
+    script_random.seed(new_stream_seed());
+    current = nullptr;
+}
+
+uint64_t Azurite::new_stream_seed()
+{
+    uint64_t state = run_seed ^ (0x9e3779b97f4a7c15ULL * ++stream_index);
+    return splitmix64(state);
+}
+
+Random& Azurite::current_random()
+{
+    return current != nullptr ? *current : script_random;
+}
+
+void Azurite::set_current_random(Random* random)
+{
+    current = random;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+// xoshiro256** by Blackman and Vigna. Small, fast and good enough for
+// audio; every wave gets its own so results don't depend on which thread
+// rendered what.
+class Random
+{
+public:
+    Random(uint64_t seed = 0);
+
+    void seed(uint64_t seed);
+    uint64_t next();
+    // Uniform in [0, 1)
+    double next_double();
+
+private:
+    uint64_t s[4];
+};
+
+
+// Two xoshiro256** streams stepped in lockstep, which SSE2 runs side by
+// side. Filled values alternate between the streams; the scalar fallback
+// produces exactly the same sequence.
+class BlockRandom
+{
+public:
+    BlockRandom(uint64_t seed = 0);
+
+    void seed(uint64_t seed);
+    // n values uniform in [-1, 1). An odd n throws the last draw away.
+    void fill(double* out, int n);
+
+private:
+    // s[word][lane]
+    alignas(16) uint64_t s[4][2];
+};
+
+
+namespace Azurite {
+    // Seed for the whole run. Set it before creating an Interpreter;
+    // without it the seed comes from the system.
+    void set_random_seed(uint64_t seed);
+    uint64_t random_seed();
+
+    // Start this thread's sequence of stream seeds (and its script-level
+    // stream) over. Called by each new Interpreter.
+    void reset_random_streams();
+    // Seed for the next wave or noise source created on this thread. The
+    // sequence only depends on the run seed and creation order.
+    uint64_t new_stream_seed();
+
+    // What rnd() draws from: the wave being rendered, or the script's stream
+    Random& current_random();
+    void set_current_random(Random* random);
+}
@@ -0,0 +1,203 @@
+#include "rendercache.h"
+#include "runtimelib.h"
+#include "processor.h"
+#include "sequencer.h"
+#include "dsp.h"
+
+RenderCache::RenderCache(long max_samples)
+    : max_samples(max_samples) {}
+
+RenderCacheEntry* RenderCache::find(uint64_t key)
+{
+    std::unordered_map<uint64_t, RenderCacheEntry>::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+RenderCacheEntry* RenderCache::insert(uint64_t key)
+{
+    if (!entries.count(key)) {
+        order.push_back(key);
+    }
+    return &entries[key];
+}
+
+void RenderCache::trim()
+{
+    long total = 0;
+    for (std::unordered_map<uint64_t, RenderCacheEntry>::iterator it = entries.begin();
+            it != entries.end(); it++) {
+        total += it->second.samples.size();
+    }
+
+    while (total > max_samples && !order.empty()) {
+        total -= entries[order.front()].samples.size();
+        entries.erase(order.front());
+        order.pop_front();
+    }
+}
+
+// Waves already hashed, by the order they were reached in. Shared and
+// cyclic references hash as that index so the walk terminates.
+typedef std::unordered_map<Wave*, int> VisitedWaves;
+
+static bool hash_wave(std::shared_ptr<Wave> wave, uint64_t& hash, VisitedWaves& visited);
+
+static bool hash_runtimeval(RuntimeValPtr value, uint64_t& hash, VisitedWaves& visited)
+{
+    hash = hash_value(value->type, hash);
+
+    switch (value->type) {
+        case RuntimeType::Number:
+            hash = hash_value(std::static_pointer_cast<Number>(value)->value, hash);
+            return true;
+        case RuntimeType::String:
+            hash = hash_string(std::static_pointer_cast<String>(value)->value, hash);
+            return true;
+        case RuntimeType::Bool:
+            hash = hash_value(std::static_pointer_cast<Bool>(value)->value, hash);
+            return true;
+        case RuntimeType::List: {
+            std::shared_ptr<List> list = std::static_pointer_cast<List>(value);
+            hash = hash_value(list->size(), hash);
+            if (list->packed) {
+                hash = hash_bytes(list->numbers.data(), list->numbers.size() * sizeof(double), hash);
+                return true;
+            }
+            for (RuntimeValPtr element : list->elements) {
+                if (!hash_runtimeval(element, hash, visited)) return false;
+            }
+            return true;
+        }
+        case RuntimeType::Buffer: {
+            std::shared_ptr<Buffer> buffer = std::static_pointer_cast<Buffer>(value);
+            hash = buffer->hash(hash);
+            return true;
+        }
+        case RuntimeType::Wave:
+            return hash_wave(std::static_pointer_cast<Wave>(value), hash, visited);
+        default:
+            return false;
+    }
+}
+
+static bool hash_expr(Expr* node, uint64_t& hash, VisitedWaves& visited)
+{
+    hash = hash_value(node->type, hash);
+
+    switch (node->type) {
+        case NodeType::NumericLiteral:
+            hash = hash_value(((NumericLiteral*)node)->value, hash);
+            return true;
+        case NodeType::StringLiteral:
+            hash = hash_string(((StringLiteral*)node)->value, hash);
+            return true;
+        case NodeType::NumberPointerNode:
+            // Always the x of the wave being hashed
+            return true;
+        case NodeType::RuntimeValPointerNode:
+            return hash_runtimeval(((RuntimeValPointerNode*)node)->value, hash, visited);
+        case NodeType::CallExpr: {
+            CallExpr* dnode = (CallExpr*)node;
+            std::string name = dnode->callee->name;
+            // Anything that isn't a pure built-in could give a different
+            // result next time (rnd is covered by the wave's stream seed)
+            if (!Azurite::is_pure_builtin(name)) {
+                return false;
+            }
+            hash = hash_string(name, hash);
+            hash = hash_value(dnode->arguments->arguments.size(), hash);
+            for (Expr* arg : dnode->arguments->arguments) {
+                if (!hash_expr(arg, hash, visited)) return false;
+            }
+            return true;
+        }
+        case NodeType::MemberExpr:
+            return hash_expr(((MemberExpr*)node)->object, hash, visited)
+                && hash_expr(((MemberExpr*)node)->index, hash, visited);
+        case NodeType::BinaryExpr: {
+            BinaryExpr* dnode = (BinaryExpr*)node;
+            hash = hash_string(dnode->op.value, hash);
+            return hash_expr(dnode->lhs, hash, visited) && hash_expr(dnode->rhs, hash, visited);
+        }
+        case NodeType::UnaryExpr: {
+            UnaryExpr* dnode = (UnaryExpr*)node;
+            hash = hash_string(dnode->op.value, hash);
+            return hash_expr(dnode->operand, hash, visited);
+        }
+        case NodeType::SharedExprNode:
+            return hash_expr(((SharedExprNode*)node)->shared->expr, hash, visited);
+        default:
+            return false;
+    }
+}
+
+static bool hash_wave(std::shared_ptr<Wave> wave, uint64_t& hash, VisitedWaves& visited)
+{
+    if (visited.count(wave.get())) {
+        hash = hash_value(visited[wave.get()], hash);
+        return true;
+    }
+
+    int index = visited.size();
+    visited[wave.get()] = index;
+    hash = hash_value(-1 - index, hash);
+
+    if (wave->fast_wave_expr == nullptr) {
+        return false;
+    }
+
+    if (wave->processor != nullptr) {
+        if (!wave->processor->hash(hash)) return false;
+        for (std::shared_ptr<Wave> input : wave->processor->inputs) {
+            if (!hash_wave(input, hash, visited)) return false;
+        }
+
+        // Voices all play the same instrument, with freq set by the notes
+        SequencerProcessor* sequencer = dynamic_cast<SequencerProcessor*>(wave->processor);
+        if (sequencer != nullptr) {
+            std::shared_ptr<Wave> voice = sequencer->voices[0].wave;
+            if (calls_function(voice, "rnd")) {
+                for (SequencerVoice& other : sequencer->voices) {
+                    hash = hash_value(other.wave->stream_seed, hash);
+                }
+            }
+            voice->phase_rate.hash(hash);
+            voice->vol_rate.hash(hash);
+            return hash_expr(voice->fast_wave_expr, hash, visited)
+                && hash_expr(voice->fast_phase_expr, hash, visited)
+                && hash_expr(voice->fast_vol_expr, hash, visited);
+        }
+        return true;
+    }
+
+    hash = hash_value(wave->decimator != nullptr ? wave->decimator->factor() : 1, hash);
+    if (wave->active_start != INT_MIN || wave->active_end != INT_MAX) {
+        hash = hash_value(wave->active_start, hash);
+        hash = hash_value(wave->active_end, hash);
+    }
+
+    // Same expressions with a different random stream are different audio
+    if (calls_function(wave, "rnd")) {
+        hash = hash_value(wave->stream_seed, hash);
+    }
+
+    wave->freq_rate.hash(hash);
+    wave->phase_rate.hash(hash);
+    wave->vol_rate.hash(hash);
+
+    return hash_expr(wave->fast_wave_expr, hash, visited)
+        && hash_expr(wave->fast_freq_expr, hash, visited)
+        && hash_expr(wave->fast_phase_expr, hash, visited)
+        && hash_expr(wave->fast_vol_expr, hash, visited)
+        && hash_expr(wave->fast_pan_expr, hash, visited);
+}
+
+bool hash_wave_graph(std::shared_ptr<Wave> root, uint64_t& hash)
+{
+    VisitedWaves visited;
+    hash = AZ_HASH_SEED;
+    return hash_wave(root, hash, visited);
+}
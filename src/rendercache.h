@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "runtimeval.h"
+#include "exprreduction.h"
+#include "hash.h"
+
+// Where a wave was in its render, enough to carry on from there
+struct WaveState {
+    double phase;
+    double x;
+    int sample;
+    // Where rnd() in the wave's exprs was in its stream
+    Random random;
+};
+
+
+class RenderCacheEntry
+{
+public:
+    std::vector<float> samples;
+    // State of each wave in the graph (in prepare order) after the last
+    // cached sample, so a longer render can continue instead of restarting
+    std::vector<WaveState> states;
+};
+
+
+// Rendered samples keyed by the structural hash of a wave graph. The key
+// doesn't include the length: a shorter render is served from the prefix
+// and a longer one extends the entry.
+class RenderCache
+{
+public:
+    RenderCache(long max_samples = 1 << 26);
+    ~RenderCache() {}
+
+    RenderCacheEntry* find(uint64_t key);
+    RenderCacheEntry* insert(uint64_t key);
+    // Evict the oldest entries until the cache is back under budget
+    void trim();
+
+private:
+    std::unordered_map<uint64_t, RenderCacheEntry> entries;
+    std::deque<uint64_t> order;
+    long max_samples;
+};
+
+// Hash of a wave's simplified expressions, the values they captured and,
+// recursively, the waves they reference. Must run after the graph has been
+// simplified. Returns false if the render isn't repeatable (print or script
+// functions in a wave expression).
+bool hash_wave_graph(std::shared_ptr<Wave> root, uint64_t& hash);
@@ -0,0 +1,76 @@
+#include "rendermanifest.h"
+#include "astcache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+// One "hash size mtime name" line per output after this header
+#define RENDER_MANIFEST_HEADER "azr " AZURITE_VERSION
+
+std::string render_manifest_path(const std::string& script_path)
+{
+    if (script_path.size() > 3 && script_path.compare(script_path.size() - 3, 3, ".az") == 0) {
+        return script_path + "r";
+    }
+    return script_path + ".azr";
+}
+
+bool load_render_manifest(const std::string& path, std::unordered_map<std::string, RenderedOutput>& outputs)
+{
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line) || line != RENDER_MANIFEST_HEADER) {
+        return false;
+    }
+
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        RenderedOutput output;
+        std::string name;
+        fields >> std::hex >> output.hash >> std::dec >> output.size >> output.mtime;
+        // The rest of the line, spaces and all
+        if (!fields || fields.get() != ' ' || !std::getline(fields, name) || name.empty()) {
+            outputs.clear();
+            return false;
+        }
+        outputs[name] = output;
+    }
+    return true;
+}
+
+bool save_render_manifest(const std::string& path, const std::unordered_map<std::string, RenderedOutput>& outputs)
+{
+    // Written to the side and renamed so a crash can't leave half a manifest
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path);
+        if (!file) {
+            return false;
+        }
+
+        file << RENDER_MANIFEST_HEADER << "\n";
+        for (const std::pair<const std::string, RenderedOutput>& entry : outputs) {
+            const RenderedOutput& output = entry.second;
+            file << std::hex << output.hash << std::dec << " " << output.size << " " << output.mtime
+                << " " << entry.first << "\n";
+        }
+        if (!file) {
+            return false;
+        }
+    }
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool stat_output(const std::string& path, RenderedOutput& output)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    output.size = st.st_size;
+    output.mtime = st.st_mtime;
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+// What a script wrote to each .wav file on its last run, so an unchanged
+// output can be skipped next time. Kept next to the script:
+// "song.az" -> "song.azr"
+std::string render_manifest_path(const std::string& script_path);
+
+// The hash of what went into an output, and the size and modification time
+// of the file it was written to, which tell if something else has written
+// over it since
+struct RenderedOutput {
+    uint64_t hash;
+    int64_t size;
+    int64_t mtime;
+};
+
+// Returns false (and leaves outputs empty) if the manifest is missing or
+// was written by another version
+bool load_render_manifest(const std::string& path, std::unordered_map<std::string, RenderedOutput>& outputs);
+bool save_render_manifest(const std::string& path, const std::unordered_map<std::string, RenderedOutput>& outputs);
+
+// Fills in size and mtime from the file at path. False if there isn't one.
+bool stat_output(const std::string& path, RenderedOutput& output);
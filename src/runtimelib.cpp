@@ -1,16 +1,36 @@
 #include "runtimelib.h"
+#include "processor.h"
+#include "filter.h"
+#include "envelope.h"
+#include "noise.h"
+#include "sequencer.h"
+#include "random.h"
+#include "wavereader.h"
 
-std::unordered_set<std::string> Azurite::builtins = {"print", "sin", "floor", "abs", "rnd", "sqrt"};
+std::unordered_set<std::string> Azurite::builtins = {"print", "sin", "floor", "abs", "rnd", "sqrt", "len", "convolve",
+    "lowpass", "highpass", "bandpass", "notch", "svf", "env", "adsr", "noise",
+    "control", "audio", "sequencer", "note", "load"};
 
 void Azurite::initialize_runtimelib()
 {
-   srand(time(NULL)); 
+    reset_random_streams();
 }
 
 bool Azurite::has_builtin(std::string name) {
     return Azurite::builtins.count(name);
 }
 
+bool Azurite::is_pure_builtin(std::string name)
+{
+    return has_builtin(name) && name != "print" && name != "note" && name != "load";
+}
+
+bool Azurite::makes_wave(std::string name)
+{
+    return name == "convolve" || name == "lowpass" || name == "highpass" || name == "bandpass"
+        || name == "notch" || name == "svf" || name == "env" || name == "adsr" || name == "noise";
+}
+
 RuntimeValPtr Azurite::call_runtimelib(std::string name, std::vector<RuntimeValPtr>& args)
 {
     if (name == "print") {
@@ -25,6 +45,26 @@ RuntimeValPtr Azurite::call_runtimelib(std::string name, std::vector<RuntimeValP
         return Azurite::rnd(args);
     } else if (name == "sqrt") {
         return Azurite::sqrt(args);
+    } else if (name == "len") {
+        return Azurite::len(args);
+    } else if (name == "convolve") {
+        return Azurite::convolve(args);
+    } else if (name == "lowpass" || name == "highpass" || name == "bandpass" || name == "notch" || name == "svf") {
+        return Azurite::filter(name, args);
+    } else if (name == "env") {
+        return Azurite::env(args);
+    } else if (name == "adsr") {
+        return Azurite::adsr(args);
+    } else if (name == "noise") {
+        return Azurite::noise(args);
+    } else if (name == "control" || name == "audio") {
+        return Azurite::rate_hint(args);
+    } else if (name == "sequencer") {
+        return Azurite::sequencer(args);
+    } else if (name == "note") {
+        return Azurite::note(args);
+    } else if (name == "load") {
+        return Azurite::load(args);
     }
 }
 
@@ -61,8 +101,7 @@ RuntimeValPtr Azurite::print(std::vector<RuntimeValPtr>& args)
 RuntimeValPtr Azurite::sin(std::vector<RuntimeValPtr>& args)
 {
     if (args[0]->type != RuntimeType::Number) {
-        std::cout << "Cannot take sin of this type.\n";
-        exit(1);
+        script_error("Cannot take sin of this type.");
     }
 
     std::shared_ptr<Number> arg_num = std::dynamic_pointer_cast<Number>(args[0]);
@@ -72,8 +111,7 @@ RuntimeValPtr Azurite::sin(std::vector<RuntimeValPtr>& args)
 RuntimeValPtr Azurite::floor(std::vector<RuntimeValPtr>& args)
 {
     if (args[0]->type != RuntimeType::Number) {
-        std::cout << "Cannot take floor of this type.\n";
-        exit(1);
+        script_error("Cannot take floor of this type.");
     }
     
     std::shared_ptr<Number> arg_num = std::dynamic_pointer_cast<Number>(args[0]);
@@ -83,8 +121,7 @@ RuntimeValPtr Azurite::floor(std::vector<RuntimeValPtr>& args)
 RuntimeValPtr Azurite::abs(std::vector<RuntimeValPtr>& args)
 {
     if (args[0]->type != RuntimeType::Number) {
-        std::cout << "Cannot take floor of this type.\n";
-        exit(1);
+        script_error("Cannot take floor of this type.");
     }
     
     std::shared_ptr<Number> arg_num = std::dynamic_pointer_cast<Number>(args[0]);
@@ -93,17 +130,317 @@ RuntimeValPtr Azurite::abs(std::vector<RuntimeValPtr>& args)
 
 RuntimeValPtr Azurite::rnd(std::vector<RuntimeValPtr>& args)
 {
-    double random = (float)(rand()) / ((float)(RAND_MAX) + 1);
-    return std::make_shared<Number>(random);
+    return std::make_shared<Number>(current_random().next_double());
 }
 
 RuntimeValPtr Azurite::sqrt(std::vector<RuntimeValPtr>& args)
 {
     if (args[0]->type != RuntimeType::Number) {
-        std::cout << "Cannot take sqrt of this type.\n";
-        exit(1);
+        script_error("Cannot take sqrt of this type.");
     }
     
     std::shared_ptr<Number> arg_num = std::dynamic_pointer_cast<Number>(args[0]);
     return std::make_shared<Number>(std::sqrt(arg_num->value));
-}
\ No newline at end of file
+}
+
+RuntimeValPtr Azurite::len(std::vector<RuntimeValPtr>& args)
+{
+    switch (args[0]->type) {
+        case RuntimeType::List:
+            return std::make_shared<Number>(std::dynamic_pointer_cast<List>(args[0])->size());
+        case RuntimeType::Buffer:
+            return std::make_shared<Number>(std::dynamic_pointer_cast<Buffer>(args[0])->size());
+        case RuntimeType::String:
+            return std::make_shared<Number>(std::dynamic_pointer_cast<String>(args[0])->value.size());
+        default:
+            script_error("Cannot take len of this type.");
+    }
+}
+
+RuntimeValPtr Azurite::rate_hint(std::vector<RuntimeValPtr>& args)
+{
+    if (args.empty()) {
+        script_error("control() and audio() take an expression.");
+    }
+    return args[0];
+}
+
+RuntimeValPtr Azurite::convolve(std::vector<RuntimeValPtr>& args)
+{
+    if (args.size() != 2) {
+        script_error("convolve(wave, impulse) takes 2 arguments.");
+    }
+
+    std::vector<double> impulse;
+
+    switch (args[1]->type) {
+        case RuntimeType::List: {
+            std::shared_ptr<List> list = std::static_pointer_cast<List>(args[1]);
+            if (list->packed) {
+                impulse = list->numbers;
+                break;
+            }
+            for (RuntimeValPtr element : list->elements) {
+                if (element->type != RuntimeType::Number) {
+                    script_error("Impulse response must be a list of numbers.");
+                }
+                impulse.push_back(std::static_pointer_cast<Number>(element)->value);
+            }
+            break;
+        }
+        case RuntimeType::Buffer: {
+            std::shared_ptr<Buffer> buffer = std::static_pointer_cast<Buffer>(args[1]);
+            std::vector<float> samples = buffer->contents();
+            impulse.assign(samples.begin(), samples.end());
+            break;
+        }
+        default:
+            script_error("Impulse response must be a list or buffer.");
+    }
+
+    if (impulse.empty()) {
+        script_error("Impulse response is empty.");
+    }
+
+    switch (args[0]->type) {
+        case RuntimeType::Wave:
+            return std::make_shared<Wave>(new ConvolveProcessor(std::static_pointer_cast<Wave>(args[0]), impulse));
+        case RuntimeType::Buffer:
+            return std::make_shared<Buffer>(convolve_samples(std::static_pointer_cast<Buffer>(args[0])->contents(), impulse));
+        default:
+            script_error("Can only convolve a wave or a buffer.");
+    }
+}
+
+static ProcessorParam to_param(RuntimeValPtr value, std::string what)
+{
+    switch (value->type) {
+        case RuntimeType::Number:
+            return ProcessorParam(std::static_pointer_cast<Number>(value)->value);
+        case RuntimeType::Wave:
+            return ProcessorParam(std::static_pointer_cast<Wave>(value));
+        default:
+            script_error(what + " must be a number or a wave.");
+    }
+}
+
+RuntimeValPtr Azurite::filter(std::string name, std::vector<RuntimeValPtr>& args)
+{
+    int max_args = name == "svf" ? 4 : 3;
+    if (args.size() < 2 || args.size() > max_args) {
+        script_error(name + "(wave, cutoff, q" + (name == "svf" ? ", mode" : "") + ") takes 2 to " + std::to_string(max_args) + " arguments.");
+    }
+
+    if (args[0]->type != RuntimeType::Wave) {
+        script_error("Can only filter a wave.");
+    }
+
+    std::shared_ptr<Wave> input = std::static_pointer_cast<Wave>(args[0]);
+    ProcessorParam cutoff = to_param(args[1], "Cutoff");
+    // Butterworth response unless asked otherwise
+    ProcessorParam q = args.size() > 2 ? to_param(args[2], "Q") : ProcessorParam(M_SQRT1_2);
+
+    if (name != "svf") {
+        FilterType filter_type = name == "lowpass" ? FilterType::Lowpass
+            : name == "highpass" ? FilterType::Highpass
+            : name == "bandpass" ? FilterType::Bandpass
+            : FilterType::Notch;
+        return std::make_shared<Wave>(new BiquadProcessor(input, filter_type, cutoff, q));
+    }
+
+    FilterType filter_type = FilterType::Lowpass;
+    if (args.size() > 3) {
+        std::string mode = args[3]->type == RuntimeType::String ? std::static_pointer_cast<String>(args[3])->value : "";
+        if (mode == "lowpass") {
+            filter_type = FilterType::Lowpass;
+        } else if (mode == "highpass") {
+            filter_type = FilterType::Highpass;
+        } else if (mode == "bandpass") {
+            filter_type = FilterType::Bandpass;
+        } else if (mode == "notch") {
+            filter_type = FilterType::Notch;
+        } else {
+            script_error("svf mode must be \"lowpass\", \"highpass\", \"bandpass\" or \"notch\".");
+        }
+    }
+    return std::make_shared<Wave>(new SvfProcessor(input, filter_type, cutoff, q));
+}
+
+static std::shared_ptr<Wave> make_envelope(std::vector<double>& times, std::vector<double>& values)
+{
+    for (double& time : times) {
+        time *= SAMPLE_RATE;
+    }
+    return std::make_shared<Wave>(new EnvelopeProcessor(times, values));
+}
+
+RuntimeValPtr Azurite::env(std::vector<RuntimeValPtr>& args)
+{
+    // Either env(t0, v0, t1, v1, ...) or env([t0, v0, t1, v1, ...])
+    std::vector<RuntimeValPtr> points = args;
+    if (args.size() == 1 && args[0]->type == RuntimeType::List) {
+        std::shared_ptr<List> list = std::static_pointer_cast<List>(args[0]);
+        points.clear();
+        for (int i = 0; i < list->size(); i++) {
+            points.push_back(list->get(i));
+        }
+    }
+
+    if (points.size() < 2 || points.size() % 2 != 0) {
+        script_error("env takes pairs of time (in seconds) and value.");
+    }
+
+    std::vector<double> times;
+    std::vector<double> values;
+
+    for (int i = 0; i < points.size(); i++) {
+        if (points[i]->type != RuntimeType::Number) {
+            script_error("Envelope points must be numbers.");
+        }
+        double value = std::static_pointer_cast<Number>(points[i])->value;
+        if (i % 2 == 0) {
+            if (!times.empty() && value < times.back()) {
+                script_error("Envelope times must not decrease.");
+            }
+            times.push_back(value);
+        } else {
+            values.push_back(value);
+        }
+    }
+
+    return make_envelope(times, values);
+}
+
+RuntimeValPtr Azurite::adsr(std::vector<RuntimeValPtr>& args)
+{
+    if (args.size() < 4 || args.size() > 5) {
+        script_error("adsr(attack, decay, sustain, release, hold) takes 4 or 5 arguments.");
+    }
+
+    double params[5] = {0.0, 0.0, 0.0, 0.0, -1.0};
+    for (int i = 0; i < args.size(); i++) {
+        if (args[i]->type != RuntimeType::Number) {
+            script_error("adsr arguments must be numbers.");
+        }
+        params[i] = std::static_pointer_cast<Number>(args[i])->value;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (i != 2 && params[i] < 0) {
+            script_error("adsr times can't be negative.");
+        }
+    }
+
+    std::vector<double> times;
+    std::vector<double> values;
+    adsr_points(params[0], params[1], params[2], params[3], params[4], times, values);
+
+    return make_envelope(times, values);
+}
+
+RuntimeValPtr Azurite::noise(std::vector<RuntimeValPtr>& args)
+{
+    NoiseColor color = NoiseColor::White;
+
+    if (args.size() > 1) {
+        script_error("noise(color) takes at most 1 argument.");
+    }
+    if (args.size() == 1) {
+        std::string name = args[0]->type == RuntimeType::String ? std::static_pointer_cast<String>(args[0])->value : "";
+        if (name == "white") {
+            color = NoiseColor::White;
+        } else if (name == "pink") {
+            color = NoiseColor::Pink;
+        } else {
+            script_error("Noise color must be \"white\" or \"pink\".");
+        }
+    }
+
+    return std::make_shared<Wave>(new NoiseProcessor(color, new_stream_seed()));
+}
+
+RuntimeValPtr Azurite::sequencer(std::vector<RuntimeValPtr>& args)
+{
+    if (args.size() < 2 || args.size() > 3) {
+        script_error("sequencer(instrument, voices, tail) takes 2 or 3 arguments.");
+    }
+    if (args[0]->type != RuntimeType::Wave || std::static_pointer_cast<Wave>(args[0])->processor != nullptr) {
+        script_error("A sequencer's instrument must be a Wave declaration.");
+    }
+    for (int i = 1; i < args.size(); i++) {
+        if (args[i]->type != RuntimeType::Number) {
+            script_error("sequencer voices and tail must be numbers.");
+        }
+    }
+
+    double voices = std::static_pointer_cast<Number>(args[1])->value;
+    if (voices != (int)voices || voices < 1 || voices > 256) {
+        script_error("A sequencer has 1 to 256 voices.");
+    }
+    // Just long enough to not click
+    double tail = 0.005;
+    if (args.size() > 2) {
+        tail = std::static_pointer_cast<Number>(args[2])->value;
+        if (tail < 0) {
+            script_error("A sequencer's tail can't be negative.");
+        }
+    }
+
+    return std::make_shared<Wave>(new SequencerProcessor(std::static_pointer_cast<Wave>(args[0]), voices,
+        std::round(tail * SAMPLE_RATE)));
+}
+
+RuntimeValPtr Azurite::note(std::vector<RuntimeValPtr>& args)
+{
+    if (args.size() < 4 || args.size() > 5) {
+        script_error("note(sequencer, start, duration, pitch, velocity) takes 4 or 5 arguments.");
+    }
+
+    SequencerProcessor* sequencer = nullptr;
+    if (args[0]->type == RuntimeType::Wave) {
+        sequencer = dynamic_cast<SequencerProcessor*>(std::static_pointer_cast<Wave>(args[0])->processor);
+    }
+    if (sequencer == nullptr) {
+        script_error("Notes can only be added to a sequencer.");
+    }
+
+    double params[4] = {0.0, 0.0, 0.0, 1.0};
+    for (int i = 1; i < args.size(); i++) {
+        if (args[i]->type != RuntimeType::Number) {
+            script_error("note arguments must be numbers.");
+        }
+        params[i - 1] = std::static_pointer_cast<Number>(args[i])->value;
+    }
+    if (params[0] < 0 || params[1] < 0) {
+        script_error("Notes can't start before 0 or have a negative duration.");
+    }
+
+    // Times in seconds, pitch in Hz
+    NoteEvent note;
+    note.start = std::round(params[0] * SAMPLE_RATE);
+    note.end = note.start + std::round(params[1] * SAMPLE_RATE);
+    note.pitch = params[2];
+    note.velocity = params[3];
+    sequencer->add_note(note);
+
+    return std::make_shared<Number>(sequencer->note_count());
+}
+
+RuntimeValPtr Azurite::load(std::vector<RuntimeValPtr>& args)
+{
+    if (args.size() != 1 || args[0]->type != RuntimeType::String) {
+        script_error("load(filename) takes a file name.");
+    }
+
+    std::string error;
+    WaveFile* file = WaveFile::open(std::static_pointer_cast<String>(args[0])->value, error);
+    if (file == nullptr) {
+        script_error(error);
+    }
+
+    if (file->sample_rate != SAMPLE_RATE) {
+        std::cout << file->path << " is " << file->sample_rate << " Hz, it will play back at " << SAMPLE_RATE << " Hz.\n";
+    }
+
+    return std::make_shared<Buffer>(std::shared_ptr<WaveFile>(file));
+}
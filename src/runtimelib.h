@@ -9,6 +9,7 @@
 #include <memory>
 
 #include "runtimeval.h"
+#include "error.h"
 
 typedef std::shared_ptr<RuntimeVal> RuntimeValPtr;
 
@@ -17,6 +18,12 @@ namespace Azurite {
 
     void initialize_runtimelib();
     bool has_builtin(std::string name);
+    // Built-ins with no side effects outside the wave being rendered, so
+    // they're safe to cache and run on any thread. rnd counts: in a wave it
+    // draws from that wave's own stream.
+    bool is_pure_builtin(std::string name);
+    // Built-ins that return a processor wave (filters, envelopes etc.)
+    bool makes_wave(std::string name);
     RuntimeValPtr call_runtimelib(std::string name, std::vector<RuntimeValPtr>& args);
 
     RuntimeValPtr print(std::vector<RuntimeValPtr>& args);
@@ -25,4 +32,20 @@ namespace Azurite {
     RuntimeValPtr abs(std::vector<RuntimeValPtr>& args);
     RuntimeValPtr rnd(std::vector<RuntimeValPtr>& args);
     RuntimeValPtr sqrt(std::vector<RuntimeValPtr>& args);
+    RuntimeValPtr len(std::vector<RuntimeValPtr>& args);
+    // control() and audio() only mean something around a whole wave slot,
+    // anywhere else they give back their expression
+    RuntimeValPtr rate_hint(std::vector<RuntimeValPtr>& args);
+    RuntimeValPtr convolve(std::vector<RuntimeValPtr>& args);
+    // lowpass, highpass, bandpass, notch and svf
+    RuntimeValPtr filter(std::string name, std::vector<RuntimeValPtr>& args);
+    RuntimeValPtr env(std::vector<RuntimeValPtr>& args);
+    RuntimeValPtr adsr(std::vector<RuntimeValPtr>& args);
+    RuntimeValPtr noise(std::vector<RuntimeValPtr>& args);
+    RuntimeValPtr sequencer(std::vector<RuntimeValPtr>& args);
+    // Adds a note to a sequencer, returns how many it has
+    RuntimeValPtr note(std::vector<RuntimeValPtr>& args);
+    // Maps a WAV file as a buffer, mixed down to mono. Not pure, since the
+    // render cache only sees the file through the buffer's hash.
+    RuntimeValPtr load(std::vector<RuntimeValPtr>& args);
 }
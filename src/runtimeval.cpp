@@ -1,9 +1,35 @@
 #include "runtimeval.h"
+#include "processor.h"
+#include "dsp.h"
+#include "oscillator.h"
+#include "wavereader.h"
+#include "hash.h"
+#include "stats.h"
 
 typedef std::shared_ptr<RuntimeVal> RuntimeValPtr;
 
+// What make_shared allocates for a value: the object and its control block
+static size_t value_size(RuntimeType type)
+{
+    size_t control_block = 2 * sizeof(void*);
+    switch (type) {
+        case RuntimeType::Number: return sizeof(Number) + control_block;
+        case RuntimeType::String: return sizeof(String) + control_block;
+        case RuntimeType::Bool: return sizeof(Bool) + control_block;
+        case RuntimeType::List: return sizeof(List) + control_block;
+        case RuntimeType::Wave: return sizeof(Wave) + control_block;
+        case RuntimeType::Buffer: return sizeof(Buffer) + control_block;
+        default: return sizeof(TailCall) + control_block;
+    }
+}
+
 RuntimeVal::RuntimeVal(RuntimeType type)
-    : type(type) {}
+    : type(type)
+{
+    if (Azurite::Stats::enabled) {
+        Azurite::Stats::count_alloc(AllocCategory::RuntimeValue, value_size(type));
+    }
+}
 
 Number::Number(double value)
     : RuntimeVal(RuntimeType::Number), value(value) {}
@@ -27,19 +53,134 @@ bool Bool::get_truth()
 }
 
 List::List(std::vector<RuntimeValPtr> elements)
-    : RuntimeVal(RuntimeType::List), elements(elements) {}
+    : RuntimeVal(RuntimeType::List), elements(std::move(elements)), packed(false) {}
+List::List(NumberArray numbers)
+    : RuntimeVal(RuntimeType::List), numbers(std::move(numbers)), packed(true) {}
 List::~List()
 {
     // for (RuntimeValPtr element : elements) {
     //     delete element;
     // }
 }
+int List::size()
+{
+    return packed ? numbers.size() : elements.size();
+}
+RuntimeValPtr List::get(int index)
+{
+    if (packed) {
+        return std::make_shared<Number>(numbers[index]);
+    }
+    return elements[index];
+}
+bool List::get_number(int index, double& value)
+{
+    if (packed) {
+        value = numbers[index];
+        return true;
+    }
+    if (elements[index]->type != RuntimeType::Number) {
+        return false;
+    }
+    value = std::static_pointer_cast<Number>(elements[index])->value;
+    return true;
+}
+void List::set(int index, RuntimeValPtr value)
+{
+    if (packed) {
+        if (value->type == RuntimeType::Number) {
+            numbers[index] = std::static_pointer_cast<Number>(value)->value;
+            return;
+        }
+        unpack();
+    }
+    elements[index] = value;
+}
+void List::unpack()
+{
+    if (!packed) return;
+
+    elements.reserve(numbers.size());
+    for (double number : numbers) {
+        elements.push_back(std::make_shared<Number>(number));
+    }
+    numbers.clear();
+    numbers.shrink_to_fit();
+    packed = false;
+}
 bool List::get_truth()
 {
-    return !elements.empty();
+    return size() != 0;
+}
+
+Buffer::Buffer(std::vector<float> samples)
+    : RuntimeVal(RuntimeType::Buffer), samples(std::move(samples))
+{
+    if (Azurite::Stats::enabled) {
+        Azurite::Stats::count_alloc(AllocCategory::Buffer, this->samples.size() * sizeof(float));
+    }
+}
+Buffer::Buffer(std::shared_ptr<WaveFile> file)
+    : RuntimeVal(RuntimeType::Buffer), file(file) {}
+int Buffer::size()
+{
+    return file != nullptr ? file->frames : samples.size();
+}
+double Buffer::sample_at(double position)
+{
+    int length = size();
+    if (position < 0 || position >= length) {
+        return 0.0;
+    }
+
+    int index = (int)position;
+    double frac = position - index;
+
+    if (file != nullptr) {
+        double a = file->sample(index);
+        if (frac == 0.0 || index + 1 >= length) {
+            return a;
+        }
+        return a + (file->sample(index + 1) - a) * frac;
+    }
+
+    if (frac == 0.0 || index + 1 >= length) {
+        return samples[index];
+    }
+
+    return samples[index] + (samples[index + 1] - samples[index]) * frac;
+}
+void Buffer::read(int start, int count, float* out)
+{
+    if (file != nullptr) {
+        file->read(start, count, out);
+    } else {
+        std::copy(samples.begin() + start, samples.begin() + start + count, out);
+    }
+}
+std::vector<float> Buffer::contents()
+{
+    if (file == nullptr) {
+        return samples;
+    }
+    std::vector<float> converted(size());
+    read(0, converted.size(), converted.data());
+    return converted;
+}
+uint64_t Buffer::hash(uint64_t hash)
+{
+    hash = hash_value(size(), hash);
+    if (file != nullptr) {
+        return file->hash(hash);
+    }
+    return hash_bytes(samples.data(), samples.size() * sizeof(float), hash);
+}
+bool Buffer::get_truth()
+{
+    return size() != 0;
 }
 
-int Wave::global_sample = 0;
+thread_local int Wave::global_sample = 0;
 
 Wave::Wave(
         Expr* wave_expr,
@@ -49,7 +190,10 @@ Wave::Wave(
         Expr* pan_expr
         )
     : RuntimeVal(RuntimeType::Wave), phase(0.0), x(0.0), sample(0),
-    wave_expr(wave_expr), freq_expr(freq_expr), phase_expr(phase_expr), vol_expr(vol_expr), pan_expr(pan_expr)
+    wave_expr(wave_expr), freq_expr(freq_expr), phase_expr(phase_expr), vol_expr(vol_expr), pan_expr(pan_expr),
+    carry(0.0), oversample(0), decimator(nullptr), stream_seed(Azurite::new_stream_seed()), processor(nullptr),
+    kernel(nullptr), active_start(INT_MIN), active_end(INT_MAX), span_start(INT_MIN), span_end(INT_MAX),
+    rendered_start(INT_MIN), lag(0)
 {
     fast_wave_expr = nullptr;
     fast_freq_expr = nullptr;
@@ -57,8 +201,39 @@ Wave::Wave(
     fast_vol_expr = nullptr;
     fast_pan_expr = nullptr;
 }
+
+// Stands in for every expr of processor and subexpression waves, which are
+// never evaluated
+static NumericLiteral processor_expr(0.0, Token(TokenType::Number, "0", 0, 0));
+
+Wave::Wave(WaveProcessor* processor)
+    : Wave(&processor_expr, &processor_expr, &processor_expr, &processor_expr, &processor_expr)
+{
+    this->processor = processor;
+}
+
+Wave::Wave(Expr* fast_expr)
+    : RuntimeVal(RuntimeType::Wave), phase(0.0), x(0.0), sample(0),
+    wave_expr(&processor_expr), freq_expr(&processor_expr), phase_expr(&processor_expr),
+    vol_expr(&processor_expr), pan_expr(&processor_expr),
+    carry(0.0), oversample(1), decimator(nullptr), stream_seed(0), processor(nullptr),
+    kernel(nullptr), active_start(INT_MIN), active_end(INT_MAX), span_start(INT_MIN), span_end(INT_MAX),
+    rendered_start(INT_MIN), lag(0)
+{
+    Token begin = fast_expr->begin;
+    fast_wave_expr = fast_expr;
+    fast_freq_expr = new NumericLiteral(0.0, begin);
+    fast_phase_expr = new NumericLiteral(0.0, begin);
+    fast_vol_expr = new NumericLiteral(1.0, begin);
+    fast_pan_expr = new NumericLiteral(0.0, begin);
+}
+
 Wave::~Wave()
 {
+    delete processor;
+    delete decimator;
+    delete kernel;
+
     if (fast_wave_expr != nullptr) {
         delete fast_wave_expr;
         delete fast_freq_expr;
@@ -77,4 +252,16 @@ Wave::~Wave()
 bool Wave::get_truth()
 {
     return true;
-}
\ No newline at end of file
+}
+
+TailCall::TailCall(
+        CallExpr* call,
+        FunctionDeclaration* func,
+        std::vector<RuntimeValPtr> args,
+        bool discard_result
+        )
+    : RuntimeVal(RuntimeType::TailCall), call(call), func(func), args(std::move(args)), discard_result(discard_result) {}
+bool TailCall::get_truth()
+{
+    return true;
+}
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <vector>
+#include <climits>
 #include <memory>
+#include <unordered_map>
 
 #include "ast.h"
+#include "random.h"
+#include "controlrate.h"
 
 enum class RuntimeType
 {
@@ -11,7 +15,10 @@ enum class RuntimeType
     String,
     Bool,
     List,
-    Wave
+    Wave,
+    Buffer,
+    // Internal: a pending tail call returned up to evaluate_callexpr
+    TailCall
 };
 
 
@@ -62,18 +69,68 @@ public:
 };
 
 
+// Contiguous storage for lists made only of numbers
+typedef std::vector<double> NumberArray;
+
+
 class List : public RuntimeVal
 {
 public:
+    // A list is packed while every element is a number. Packed lists keep
+    // their values in numbers and leave elements empty; storing anything
+    // else boxes them into elements for good.
     std::vector<std::shared_ptr<RuntimeVal>> elements;
+    NumberArray numbers;
+    bool packed;
 
     List(std::vector<std::shared_ptr<RuntimeVal>> elements);
+    List(NumberArray numbers);
     ~List();
 
+    int size();
+    std::shared_ptr<RuntimeVal> get(int index);
+    // Reads a number element without boxing it. False if it isn't a number.
+    bool get_number(int index, double& value);
+    void set(int index, std::shared_ptr<RuntimeVal> value);
+    void unpack();
+
+    bool get_truth();
+};
+
+
+// Rendered audio. Indexing with a fractional position interpolates
+// linearly between samples and anything outside the buffer is silence.
+class WaveFile;
+
+class Buffer : public RuntimeVal
+{
+public:
+    std::vector<float> samples;
+    // Set for buffers loaded from a file, which are read from it in place
+    // and leave samples empty
+    std::shared_ptr<WaveFile> file;
+
+    Buffer(std::vector<float> samples);
+    Buffer(std::shared_ptr<WaveFile> file);
+    ~Buffer() {}
+
+    int size();
+    double sample_at(double position);
+    // Copy count samples from start into out
+    void read(int start, int count, float* out);
+    // All the samples, converted from the file if there is one
+    std::vector<float> contents();
+    uint64_t hash(uint64_t hash);
+
     bool get_truth();
 };
 
 
+class WaveProcessor;
+class Decimator;
+class OscillatorKernel;
+
+
 class Wave : public RuntimeVal
 {
 public:
@@ -93,7 +150,55 @@ public:
     double phase;
     double x;
     int sample;
-    static int global_sample;
+    // Per thread, since waves can render on several threads at once
+    static thread_local int global_sample;
+
+    // This wave's samples for the block being rendered (see WaveGraph)
+    std::vector<double> block;
+    // The sample before block[0], for readers interpolating between samples
+    double carry;
+
+    // Oversampling factor set on the wave, 0 to use the render's default
+    int oversample;
+    // Set while rendering oversampled. Owned.
+    Decimator* decimator;
+
+    // rnd() in this wave's expressions draws from here. Reseeded from
+    // stream_seed before every render so renders repeat.
+    uint64_t stream_seed;
+    Random random;
+
+    // Set for waves made by native built-ins (convolve etc.), which fill
+    // their block directly instead of evaluating the exprs. Owned.
+    WaveProcessor* processor;
+
+    // Waves made by built-in calls in this wave's exprs, e.g. the adsr() in
+    // vol: adsr(...), by call. Kept across prepares so they're made once.
+    std::unordered_map<Expr*, std::shared_ptr<RuntimeVal>> made_waves;
+
+    // Set by prepare when the wave's simplified exprs match a built-in
+    // oscillator shape, which then renders its blocks. Owned.
+    OscillatorKernel* kernel;
+
+    // How often freq, phase and vol are evaluated, set by prepare
+    ControlParam freq_rate;
+    ControlParam phase_rate;
+    ControlParam vol_rate;
+
+    // Declared with active:, in samples. The wave is silent outside it.
+    int active_start;
+    int active_end;
+    // Where the output can be non-zero: the declared range narrowed down by
+    // what prepare can prove from the exprs (see compute_spans). Blocks
+    // outside it aren't evaluated.
+    int span_start;
+    int span_end;
+    // Start of the block this wave was last rendered for by a live voice.
+    // Voices of one script can share waves, which only render once a block.
+    int rendered_start;
+    // How many samples behind the block the wave renders, so the waves it
+    // reads line up after decimation delays (see compensate_latency)
+    int lag;
 
     Wave(
         Expr* wave_expr,
@@ -102,8 +207,32 @@ public:
         Expr* vol_expr,
         Expr* pan_expr
     );
+    Wave(WaveProcessor* processor);
+    // Renders an already simplified expression (a subexpression several
+    // waves share). Takes no random stream, it never calls rnd.
+    Wave(Expr* fast_expr);
     ~Wave();
 
     bool get_truth();
 };
 
+
+class TailCall : public RuntimeVal
+{
+public:
+    CallExpr* call;
+    FunctionDeclaration* func;
+    std::vector<std::shared_ptr<RuntimeVal>> args;
+    // True when the call was a bare statement, so its value is thrown away
+    bool discard_result;
+
+    TailCall(
+        CallExpr* call,
+        FunctionDeclaration* func,
+        std::vector<std::shared_ptr<RuntimeVal>> args,
+        bool discard_result
+    );
+    ~TailCall() {}
+
+    bool get_truth();
+};
@@ -0,0 +1,191 @@
+#include "sequencer.h"
+#include "exprreduction.h"
+#include "oscillator.h"
+#include "wavegraph.h"
+#include "hash.h"
+
+#include <algorithm>
+
+SequencerProcessor::SequencerProcessor(std::shared_ptr<Wave> instrument, int voice_count, int tail)
+    : next_note(0), tail(tail)
+{
+    for (int i = 0; i < voice_count; i++) {
+        SequencerVoice voice;
+        voice.wave = std::make_shared<Wave>(instrument->wave_expr, instrument->freq_expr, instrument->phase_expr,
+            instrument->vol_expr, instrument->pan_expr);
+        // Notes start mid-block, which oversampled waves can't
+        voice.wave->oversample = 1;
+        voice.active = false;
+        voices.push_back(voice);
+    }
+}
+
+void SequencerProcessor::add_note(NoteEvent note)
+{
+    notes.push_back(note);
+}
+
+void SequencerProcessor::reset()
+{
+    // Stable, so notes starting together keep the order they were added in
+    std::stable_sort(notes.begin(), notes.end(), [](const NoteEvent& a, const NoteEvent& b) {
+        return a.start < b.start;
+    });
+    next_note = 0;
+
+    for (SequencerVoice& voice : voices) {
+        voice.active = false;
+    }
+}
+
+SequencerVoice& SequencerProcessor::allocate(int start)
+{
+    SequencerVoice* released = nullptr;
+    SequencerVoice* oldest = nullptr;
+
+    for (SequencerVoice& voice : voices) {
+        if (!voice.active) {
+            return voice;
+        }
+        if (voice.note_end <= start && (released == nullptr || voice.note_end < released->note_end)) {
+            released = &voice;
+        }
+        if (oldest == nullptr || voice.note_start < oldest->note_start) {
+            oldest = &voice;
+        }
+    }
+
+    return released != nullptr ? *released : *oldest;
+}
+
+void SequencerProcessor::start_note(SequencerVoice& voice, const NoteEvent& note, int index)
+{
+    voice.active = true;
+    voice.note_start = note.start;
+    voice.note_end = note.end;
+    voice.end = note.end + tail;
+    voice.velocity = note.velocity;
+
+    // The voice's freq is a literal that stands for the pitch
+    Wave* wave = voice.wave.get();
+    ((NumericLiteral*)wave->fast_freq_expr)->value = note.pitch;
+    if (wave->kernel != nullptr) {
+        wave->kernel->freq.value = note.pitch;
+    }
+
+    restart(voice.wave, index);
+    for (std::shared_ptr<Wave> own : voice.own) {
+        restart(own, index);
+    }
+}
+
+void SequencerProcessor::restart(std::shared_ptr<Wave> wave, int index)
+{
+    wave->freq_rate.reset();
+    wave->phase_rate.reset();
+    wave->vol_rate.reset();
+    wave->sample = 0;
+    wave->phase = 0;
+    wave->x = 0;
+    wave->block.assign(BLOCK_SIZE, 0.0);
+    wave->carry = 0.0;
+    // Every note gets its own noise
+    wave->random.seed(hash_value(index, wave->stream_seed));
+    if (wave->processor != nullptr) {
+        wave->processor->reset();
+    }
+}
+
+void SequencerProcessor::process(std::vector<double>& out, int start, int count)
+{
+    int end = start + count;
+    std::fill(out.begin(), out.begin() + count, 0.0);
+
+    for (; next_note < notes.size() && notes[next_note].start < end; next_note++) {
+        const NoteEvent& note = notes[next_note];
+        if (note.end + tail > start) {
+            start_note(allocate(start), note, next_note);
+        }
+    }
+
+    for (SequencerVoice& voice : voices) {
+        if (!voice.active) {
+            continue;
+        }
+
+        // The part of the block before the note is rendered and thrown away,
+        // so the voice stays on the block grid the waves it reads are on
+        for (std::shared_ptr<Wave> own : voice.own) {
+            render_voice(own, start - voice.note_start, count);
+        }
+        render_voice(voice.wave, start - voice.note_start, count);
+
+        double* samples = voice.wave->block.data();
+        int first = std::max(0, voice.note_start - start);
+        int last = std::min(count, voice.end - start);
+        for (int i = first; i < last; i++) {
+            int time = start + i;
+            double gain = voice.velocity;
+            if (time >= voice.note_end) {
+                gain *= 1.0 - (double)(time - voice.note_end) / tail;
+            }
+            out[i] += samples[i] * gain;
+        }
+
+        if (voice.end <= end) {
+            voice.active = false;
+        }
+    }
+}
+
+bool SequencerProcessor::hash(uint64_t& hash)
+{
+    // The voices' expressions are hashed with the waves, see hash_wave
+    hash = hash_string("sequencer", hash);
+    hash = hash_value(voices.size(), hash);
+    hash = hash_value(tail, hash);
+    hash = hash_value(notes.size(), hash);
+    for (const NoteEvent& note : notes) {
+        hash = hash_value(note.start, hash);
+        hash = hash_value(note.end, hash);
+        hash = hash_value(note.pitch, hash);
+        hash = hash_value(note.velocity, hash);
+    }
+    return true;
+}
+
+void SequencerProcessor::span(int& start, int& end)
+{
+    if (notes.empty()) {
+        end = start;
+        return;
+    }
+    int first = notes[0].start;
+    int last = notes[0].end;
+    for (const NoteEvent& note : notes) {
+        first = std::min(first, note.start);
+        last = std::max(last, note.end);
+    }
+    start = std::max(start, first);
+    end = std::min(end, last + tail);
+}
+
+void SequencerProcessor::replace_input(Wave* input, std::shared_ptr<Wave> replacement)
+{
+    WaveProcessor::replace_input(input, replacement);
+
+    std::function<std::shared_ptr<Wave>(std::shared_ptr<Wave>)> replace = [&](std::shared_ptr<Wave> wave) {
+        return wave.get() == input ? replacement : wave;
+    };
+    for (SequencerVoice& voice : voices) {
+        replace_wave_refs(voice.wave, replace);
+        for (std::shared_ptr<Wave> own : voice.own) {
+            replace_wave_refs(own, replace);
+        }
+    }
+}
+
+bool SequencerProcessor::pure()
+{
+    return voices.empty() || is_pure_wave(voices[0].wave);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "processor.h"
+
+// A note scheduled on a sequencer, in samples
+struct NoteEvent {
+    int start;
+    int end;
+    double pitch;
+    double velocity;
+};
+
+// One wave of the pool, playing a note or free
+struct SequencerVoice {
+    std::shared_ptr<Wave> wave;
+    // Waves only this voice reads, in the order they render before it: the
+    // envelopes, filters etc. made by calls in its slots, and its copies of
+    // envelopes the instrument reads through variables
+    std::vector<std::shared_ptr<Wave>> own;
+    bool active;
+    int note_start;
+    int note_end;
+    // note_end plus the tail
+    int end;
+    double velocity;
+};
+
+
+// sequencer(instrument, voices, tail). Plays notes on a fixed pool of
+// copies of the instrument wave, each with its freq set to the note's pitch
+// and x in its freq, phase and vol counting samples from the note's start.
+// A voice's own waves (see SequencerVoice) restart with each note too; other
+// waves the instrument reads are shared and keep song time. Only voices
+// playing a note render, so the cost follows the notes sounding rather than
+// the notes in the song.
+//
+// After its end a note fades out over the tail. When all voices are busy a
+// new note takes the one that was released first, or failing that the
+// oldest; the stolen note stops at the start of the block.
+class SequencerProcessor : public WaveProcessor
+{
+public:
+    std::vector<SequencerVoice> voices;
+    // Renders a voice's block, with start counted from the voice's note.
+    // Set by the interpreter, which also prepares the voice waves and their
+    // own waves, and sets inputs to the shared waves they read.
+    std::function<void(std::shared_ptr<Wave> voice, int start, int count)> render_voice;
+
+    SequencerProcessor(std::shared_ptr<Wave> instrument, int voice_count, int tail);
+    ~SequencerProcessor() {}
+
+    void add_note(NoteEvent note);
+    int note_count() { return notes.size(); }
+
+    void reset();
+    void process(std::vector<double>& out, int start, int count);
+    bool hash(uint64_t& hash);
+    bool pure();
+    void span(int& start, int& end);
+    // Also in the voices, which are what read the inputs
+    void replace_input(Wave* input, std::shared_ptr<Wave> replacement);
+
+private:
+    std::vector<NoteEvent> notes;
+    int next_note;
+    int tail;
+
+    SequencerVoice& allocate(int start);
+    void start_note(SequencerVoice& voice, const NoteEvent& note, int index);
+    void restart(std::shared_ptr<Wave> wave, int index);
+};
@@ -0,0 +1,308 @@
+#include "server.h"
+#include "interpreter.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+#define MAX_CACHED_PROGRAMS 64
+#define MAX_HEADER_LINE 4096
+#define MAX_SOURCE_LENGTH (16 << 20)
+
+// Parsed programs by source hash, shared by every worker. Least recently
+// used last.
+static std::mutex programs_mutex;
+static std::list<std::pair<uint64_t, std::shared_ptr<Program>>> programs;
+
+// Render caches can't be shared between interpreters running at the same
+// time, so each worker keeps its own
+static thread_local RenderCache* worker_render_cache = nullptr;
+
+static std::shared_ptr<Program> get_program(const std::string& source)
+{
+    uint64_t key = program_cache_key(source);
+
+    {
+        std::lock_guard<std::mutex> lock(programs_mutex);
+        for (auto it = programs.begin(); it != programs.end(); it++) {
+            if (it->first == key) {
+                programs.splice(programs.begin(), programs, it);
+                return it->second;
+            }
+        }
+    }
+
+    Parser parser;
+    std::shared_ptr<Program> program(parser.parse(source));
+
+    std::lock_guard<std::mutex> lock(programs_mutex);
+    programs.push_front(std::make_pair(key, program));
+    if (programs.size() > MAX_CACHED_PROGRAMS) {
+        programs.pop_back();
+    }
+    return program;
+}
+
+// Buffered reads from a connection
+class Connection
+{
+public:
+    Connection(int fd) : fd(fd), pos(0) {}
+    ~Connection() { close(fd); }
+
+    bool read_line(std::string& line)
+    {
+        line.clear();
+        char c;
+        while (read_bytes(&c, 1)) {
+            if (c == '\n') {
+                return true;
+            }
+            if (line.size() >= MAX_HEADER_LINE) {
+                return false;
+            }
+            line += c;
+        }
+        return false;
+    }
+
+    bool read_bytes(char* out, size_t count)
+    {
+        while (count > 0) {
+            if (pos == buffer.size()) {
+                buffer.resize(4096);
+                ssize_t got = recv(fd, &buffer[0], buffer.size(), 0);
+                if (got <= 0) {
+                    buffer.clear();
+                    pos = 0;
+                    return false;
+                }
+                buffer.resize(got);
+                pos = 0;
+            }
+            size_t n = std::min(count, buffer.size() - pos);
+            memcpy(out, buffer.data() + pos, n);
+            pos += n;
+            out += n;
+            count -= n;
+        }
+        return true;
+    }
+
+    bool write_bytes(const char* data, size_t count)
+    {
+        while (count > 0) {
+            ssize_t sent = send(fd, data, count, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                return false;
+            }
+            data += sent;
+            count -= sent;
+        }
+        return true;
+    }
+
+    bool write_string(const std::string& text)
+    {
+        return write_bytes(text.data(), text.size());
+    }
+
+private:
+    int fd;
+    std::string buffer;
+    size_t pos;
+};
+
+static void send_error(Connection& connection, std::string message)
+{
+    for (char& c : message) {
+        if (c == '\n') c = ' ';
+    }
+    connection.write_string("error " + message + "\n");
+}
+
+static void handle_request(int fd, const ScriptOptions& options)
+{
+    Connection connection(fd);
+
+    std::string path;
+    std::string source;
+    bool has_source = false;
+    long source_length = 0;
+    int oversample = options.oversample;
+    bool return_samples = false;
+
+    std::string line;
+    while (true) {
+        if (!connection.read_line(line)) {
+            send_error(connection, "Incomplete request.");
+            return;
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            break;
+        }
+
+        size_t space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+
+        if (key == "path") {
+            path = value;
+        } else if (key == "source") {
+            char* end;
+            source_length = std::strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || source_length < 0 || source_length > MAX_SOURCE_LENGTH) {
+                send_error(connection, "Script length must be 0 to " + std::to_string(MAX_SOURCE_LENGTH) + " bytes.");
+                return;
+            }
+            has_source = true;
+        } else if (key == "oversample") {
+            oversample = std::atoi(value.c_str());
+            if (!Interpreter::valid_oversample(oversample)) {
+                send_error(connection, "Oversampling factor must be 1, 2, 4 or 8.");
+                return;
+            }
+        } else if (key == "output") {
+            return_samples = value == "samples";
+        } else {
+            send_error(connection, "Unknown request field " + key + ".");
+            return;
+        }
+    }
+
+    if (has_source) {
+        source.resize(source_length);
+        if (!connection.read_bytes(&source[0], source_length)) {
+            send_error(connection, "Incomplete script.");
+            return;
+        }
+    } else if (!path.empty()) {
+        std::ifstream source_file(path);
+        if (!source_file) {
+            send_error(connection, "Could not open " + path);
+            return;
+        }
+        std::stringstream buffer;
+        buffer << source_file.rdbuf();
+        source = buffer.str();
+    } else {
+        send_error(connection, "Request has no path or source.");
+        return;
+    }
+
+    if (worker_render_cache == nullptr) {
+        worker_render_cache = new RenderCache();
+    }
+
+    std::vector<RenderedBus> buses;
+    try {
+        std::shared_ptr<Program> program = get_program(source);
+
+        Interpreter interpreter;
+        interpreter.set_oversample(oversample);
+        interpreter.set_render_cache(worker_render_cache);
+        interpreter.capture_output(&buses);
+        interpreter.interpret_program(program.get());
+    } catch (ScriptError& e) {
+        send_error(connection, e.what());
+        return;
+    }
+
+    std::ostringstream header;
+    header << "ok " << buses.size() << "\n";
+    if (!connection.write_string(header.str())) {
+        return;
+    }
+
+    for (RenderedBus& bus : buses) {
+        std::ostringstream bus_header;
+        if (return_samples) {
+            bus_header << "samples " << bus.name << " " << bus.samples.size() << "\n";
+            connection.write_string(bus_header.str());
+            connection.write_bytes((const char*)bus.samples.data(), bus.samples.size() * sizeof(float));
+        } else {
+            WaveBuffer buffer;
+            buffer.length = bus.samples.size();
+            buffer.data.swap(bus.samples);
+            write_wave_file(bus.name, &buffer, 1);
+
+            bus_header << "file " << bus.name << " " << buffer.length << "\n";
+            connection.write_string(bus_header.str());
+        }
+    }
+}
+
+int run_server(const std::string& socket_path, const ScriptOptions& options, int workers)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        std::cout << "Socket path is too long: " << socket_path << "\n";
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cout << "Could not create socket: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    // A socket file left by a server that didn't shut down cleanly
+    unlink(socket_path.c_str());
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 64) < 0) {
+        std::cout << "Could not listen on " << socket_path << ": " << strerror(errno) << "\n";
+        close(listener);
+        return 1;
+    }
+
+    std::cout << "Listening on " << socket_path << " with " << workers << " workers\n";
+    std::cout.flush();
+
+    ThreadPool pool(workers);
+
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cout << "accept failed: " << strerror(errno) << "\n";
+            break;
+        }
+
+        pool.submit([fd, &options] { handle_request(fd, options); });
+    }
+
+    close(listener);
+    unlink(socket_path.c_str());
+    pool.wait();
+    return 1;
+}
+
+#else
+
+// Unix domain sockets only
+int run_server(const std::string& socket_path, const ScriptOptions& options, int workers)
+{
+    std::cout << "--serve is not supported on this platform.\n";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+#include "batch.h"
+
+// az --serve=path listens on a Unix domain socket and renders scripts sent
+// to it, one request per connection, on a pool of worker threads. Parsed
+// programs and rendered waves are kept between requests.
+//
+// A request is a few "key value" header lines ended by an empty line:
+//
+//     path /abs/song.az      script to render, or
+//     source 1234            a script of that many bytes (up to 16 MiB) sent after the header
+//     oversample 2           optional, default is the server's
+//     output samples         optional, return samples instead of writing files
+//
+// The response is "ok n" and one line per .wav bus, either "file name length"
+// (written relative to the server's working directory) or, with output samples, "samples name length" followed by length 32-bit
+// floats in native byte order. A failed request gets "error message".
+int run_server(const std::string& socket_path, const ScriptOptions& options, int workers);
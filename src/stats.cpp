@@ -0,0 +1,212 @@
+#include "stats.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <algorithm>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+bool Azurite::Stats::enabled = false;
+
+struct AllocCounter {
+    std::atomic<long> count;
+    std::atomic<long> bytes;
+};
+
+static AllocCounter heap_allocs;
+static std::atomic<long> heap_frees;
+static AllocCounter category_allocs[(int)AllocCategory::Count];
+
+static std::atomic<long> phase_nanos[(int)StatsPhase::Count];
+static thread_local Azurite::Stats::PhaseTimer* current_timer = nullptr;
+
+// Runtime values made while something was rendering, for the churn per sample
+static std::atomic<int> rendering;
+static std::atomic<long> render_values;
+static std::atomic<long> rendered_samples;
+
+void* operator new(size_t size)
+{
+    if (Azurite::Stats::enabled) {
+        heap_allocs.count.fetch_add(1, std::memory_order_relaxed);
+        heap_allocs.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    void* ptr = std::malloc(size > 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (Azurite::Stats::enabled && ptr != nullptr) {
+        heap_frees.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void Azurite::Stats::count_alloc(AllocCategory category, size_t bytes)
+{
+    AllocCounter& counter = category_allocs[(int)category];
+    counter.count.fetch_add(1, std::memory_order_relaxed);
+    counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    if (category == AllocCategory::RuntimeValue && rendering.load(std::memory_order_relaxed) > 0) {
+        render_values.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Azurite::Stats::count_rendered(long samples)
+{
+    rendered_samples += samples;
+}
+
+Azurite::Stats::PhaseTimer::PhaseTimer(StatsPhase phase)
+    : phase(phase), outer(current_timer)
+{
+    if (!enabled) {
+        return;
+    }
+    if (outer != nullptr) {
+        outer->add_elapsed();
+    }
+    if (phase == StatsPhase::Render) {
+        rendering++;
+    }
+    current_timer = this;
+    start = std::chrono::steady_clock::now();
+}
+
+Azurite::Stats::PhaseTimer::~PhaseTimer()
+{
+    if (!enabled) {
+        return;
+    }
+    add_elapsed();
+    if (phase == StatsPhase::Render) {
+        rendering--;
+    }
+    current_timer = outer;
+    if (outer != nullptr) {
+        outer->start = std::chrono::steady_clock::now();
+    }
+}
+
+void Azurite::Stats::PhaseTimer::add_elapsed()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    phase_nanos[(int)phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+    start = now;
+}
+
+static const char* phase_name(StatsPhase phase)
+{
+    switch (phase) {
+        case StatsPhase::Lex: return "lex";
+        case StatsPhase::Parse: return "parse";
+        case StatsPhase::Execute: return "execute";
+        case StatsPhase::Render: return "render";
+        case StatsPhase::Write: return "write";
+        default: return "";
+    }
+}
+
+static const char* category_name(AllocCategory category)
+{
+    switch (category) {
+        case AllocCategory::RuntimeValue: return "runtime values";
+        case AllocCategory::AstNode: return "AST nodes";
+        case AllocCategory::Environment: return "environments";
+        case AllocCategory::Buffer: return "buffers";
+        default: return "";
+    }
+}
+
+static void report_allocs(std::ostream& out, const char* name, long count, long bytes)
+{
+    out << "  " << std::left << std::setw(16) << name << std::right
+        << std::setw(12) << count << std::setw(12) << std::setprecision(2) << bytes / 1048576.0 << " MB\n";
+}
+
+void Azurite::Stats::report(std::ostream& out)
+{
+    long count = heap_allocs.count;
+    long bytes = heap_allocs.bytes;
+
+    // Counted before printing allocates anything
+    long other_count = count;
+    long other_bytes = bytes;
+    long category_count[(int)AllocCategory::Count];
+    long category_bytes[(int)AllocCategory::Count];
+    for (int i = 0; i < (int)AllocCategory::Count; i++) {
+        category_count[i] = category_allocs[i].count;
+        category_bytes[i] = category_allocs[i].bytes;
+        other_count -= category_count[i];
+        other_bytes -= category_bytes[i];
+    }
+
+    std::ostringstream report;
+    report << std::fixed << "Time:\n";
+    double total_ms = 0;
+    for (int i = 0; i < (int)StatsPhase::Count; i++) {
+        double ms = phase_nanos[i] / 1e6;
+        total_ms += ms;
+        report << "  " << std::left << std::setw(16) << phase_name((StatsPhase)i) << std::right
+            << std::setw(12) << std::setprecision(1) << ms << " ms\n";
+    }
+    report << "  " << std::left << std::setw(16) << "total" << std::right
+        << std::setw(12) << std::setprecision(1) << total_ms << " ms\n";
+
+    report << "Allocations:\n";
+    for (int i = 0; i < (int)AllocCategory::Count; i++) {
+        report_allocs(report, category_name((AllocCategory)i), category_count[i], category_bytes[i]);
+    }
+    // Runtime value bytes are the objects' sizes, the categories can come
+    // to a little more or less than what really went through operator new
+    report_allocs(report, "other", std::max(0L, other_count), std::max(0L, other_bytes));
+    report_allocs(report, "total", count, bytes);
+    report << "  " << heap_frees << " frees, " << count - heap_frees << " still allocated\n";
+
+    if (rendered_samples > 0) {
+        report << "Runtime values made per rendered sample: " << std::setprecision(2)
+            << (double)render_values / rendered_samples
+            << " (" << render_values << " over " << rendered_samples << " samples)\n";
+    }
+
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // Kilobytes on Linux
+        report << "Peak RSS: " << std::setprecision(1) << usage.ru_maxrss / 1024.0 << " MB\n";
+    }
+#endif
+
+    out << report.str();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <chrono>
+#include <iostream>
+
+// --stats: where a run's time and memory went. Every heap allocation goes
+// through counting operator new and delete (see stats.cpp), and the kinds
+// of object worth telling apart count themselves by category:
+// - AST nodes and environments through their own operator new
+// - runtime values in their constructor, since make_shared goes around
+//   class operator new
+// - buffers by the sample storage they add
+// Counting only happens with --stats, otherwise the hooks are one branch.
+
+enum class AllocCategory
+{
+    RuntimeValue,
+    AstNode,
+    Environment,
+    Buffer,
+    Count
+};
+
+enum class StatsPhase
+{
+    Lex,
+    Parse,
+    Execute,
+    Render,
+    Write,
+    Count
+};
+
+namespace Azurite {
+    namespace Stats {
+        // Set once at startup, before any threads
+        extern bool enabled;
+
+        void count_alloc(AllocCategory category, size_t bytes);
+        void count_rendered(long samples);
+        void report(std::ostream& out);
+
+        // Times its scope into a phase. Phases nest on a thread, with the
+        // inner phase's time taken out of the outer one, so the execute
+        // time doesn't include the render() and write() calls it made.
+        class PhaseTimer
+        {
+        public:
+            PhaseTimer(StatsPhase phase);
+            ~PhaseTimer();
+
+        private:
+            StatsPhase phase;
+            PhaseTimer* outer;
+            std::chrono::steady_clock::time_point start;
+
+            void add_elapsed();
+        };
+    }
+}
@@ -0,0 +1,166 @@
+#include "threadpool.h"
+
+// Which pool and queue the current thread works for
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local int current_index = -1;
+
+ThreadPool::ThreadPool(int num_threads)
+    : pending(0), stopping(false), queued(0)
+{
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    for (int i = 0; i <= num_threads; i++) {
+        queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    }
+
+    for (int i = 0; i < num_threads; i++) {
+        threads.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+int ThreadPool::size()
+{
+    return threads.size();
+}
+
+int ThreadPool::default_threads()
+{
+    int count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    int index = current_pool == this ? current_index : queues.size() - 1;
+
+    pending++;
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        queued++;
+    }
+    wake.notify_one();
+    done.notify_all();
+}
+
+bool ThreadPool::pop(int index, std::function<void()>& task)
+{
+    // Own work first, newest first
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        if (!queues[index]->tasks.empty()) {
+            task = std::move(queues[index]->tasks.back());
+            queues[index]->tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Then steal the oldest task from someone else
+    for (int i = 1; i < queues.size(); i++) {
+        WorkQueue* victim = queues[(index + i) % queues.size()].get();
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if (!victim->tasks.empty()) {
+            task = std::move(victim->tasks.front());
+            victim->tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ThreadPool::run_one(int index)
+{
+    std::function<void()> task;
+    if (!pop(index, task)) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        queued--;
+    }
+
+    ThreadPool* outer_pool = current_pool;
+    int outer_index = current_index;
+    current_pool = this;
+    current_index = index;
+
+    try {
+        task();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+            error = std::current_exception();
+        }
+    }
+
+    current_pool = outer_pool;
+    current_index = outer_index;
+
+    if (--pending == 0) {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        done.notify_all();
+    }
+
+    return true;
+}
+
+void ThreadPool::worker_loop(int index)
+{
+    while (true) {
+        if (run_one(index)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::wait()
+{
+    int index = current_pool == this ? current_index : queues.size() - 1;
+
+    while (pending > 0) {
+        if (run_one(index)) {
+            continue;
+        }
+
+        // Sleeps while the tasks left are running on other threads
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        done.wait(lock, [this] { return pending == 0 || queued > 0; });
+    }
+
+    std::exception_ptr thrown;
+    {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        std::swap(thrown, error);
+    }
+    if (thrown) {
+        std::rethrow_exception(thrown);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Each worker pops from the back of its own deque
+// and steals from the front of the others when it runs dry. Tasks submitted
+// from inside a task go to the submitting worker's deque, so a task that
+// unlocks its dependents usually runs them next while they're cache-hot.
+class ThreadPool
+{
+public:
+    ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+    // Run tasks on the calling thread until everything submitted so far,
+    // including tasks those tasks submit, has finished. Rethrows the first
+    // exception a task threw.
+    void wait();
+
+    int size();
+
+    static int default_threads();
+
+private:
+    struct WorkQueue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    // One queue per worker plus one for threads outside the pool
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> threads;
+
+    std::atomic<int> pending;
+    std::atomic<bool> stopping;
+    // Tasks sitting in the queues. Only changed and checked under
+    // sleep_mutex, so a thread can't decide to sleep between a task being
+    // queued and the wakeup for it.
+    int queued;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    void worker_loop(int index);
+    bool run_one(int index);
+    bool pop(int index, std::function<void()>& task);
+};
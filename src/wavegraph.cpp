@@ -0,0 +1,86 @@
+#include "wavegraph.h"
+#include "processor.h"
+
+// DFS states
+#define UNVISITED 0
+#define ON_STACK 1
+#define DONE 2
+
+WaveGraph::WaveGraph(std::shared_ptr<Wave> root)
+    : feedback_edges(0), is_chain(true), stateful_nodes(0)
+{
+    std::unordered_map<Wave*, int> state;
+    visit(root, state);
+
+    deps.resize(nodes.size());
+    dependents.resize(nodes.size());
+
+    for (int i = 0; i < nodes.size(); i++) {
+        std::vector<std::shared_ptr<Wave>> refs;
+        collect_wave_refs(nodes[i], refs);
+
+        for (std::shared_ptr<Wave> ref : refs) {
+            int dep = index[ref.get()];
+
+            // A reference to something evaluated later (or to itself) reads
+            // last block's samples. That wave must not overwrite them before
+            // the reader is done, so the edge is kept the other way round.
+            if (dep >= i) {
+                feedback_edges++;
+                if (dep > i) {
+                    add_edge(i, dep);
+                }
+                continue;
+            }
+            add_edge(dep, i);
+        }
+    }
+
+    int sources = 0;
+    for (int i = 0; i < nodes.size(); i++) {
+        if ((nodes[i]->processor != nullptr && !nodes[i]->processor->stateless())
+                || nodes[i]->decimator != nullptr
+                || nodes[i]->freq_rate.rate == ParamRate::Control
+                || nodes[i]->phase_rate.rate == ParamRate::Control
+                || nodes[i]->vol_rate.rate == ParamRate::Control) {
+            stateful_nodes++;
+        }
+        if (deps[i].size() > 1 || dependents[i].size() > 1) {
+            is_chain = false;
+        }
+        if (deps[i].empty()) {
+            sources++;
+        }
+    }
+    if (sources > 1) {
+        is_chain = false;
+    }
+}
+
+void WaveGraph::add_edge(int from, int to)
+{
+    if (std::find(deps[to].begin(), deps[to].end(), from) == deps[to].end()) {
+        deps[to].push_back(from);
+        dependents[from].push_back(to);
+    }
+}
+
+// Post-order DFS, so every node lands after the nodes it reads. Anything
+// found while still on the stack is part of a cycle and is skipped here.
+void WaveGraph::visit(std::shared_ptr<Wave> wave, std::unordered_map<Wave*, int>& state)
+{
+    state[wave.get()] = ON_STACK;
+
+    std::vector<std::shared_ptr<Wave>> refs;
+    collect_wave_refs(wave, refs);
+
+    for (std::shared_ptr<Wave> ref : refs) {
+        if (state[ref.get()] == UNVISITED) {
+            visit(ref, state);
+        }
+    }
+
+    state[wave.get()] = DONE;
+    index[wave.get()] = nodes.size();
+    nodes.push_back(wave);
+}
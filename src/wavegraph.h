@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "runtimeval.h"
+#include "exprreduction.h"
+
+// Samples rendered per node before moving to the next node
+#define BLOCK_SIZE 256
+
+// The waves a render depends on, as a DAG extracted from their simplified
+// expressions. Each node is evaluated once per block into Wave::block and
+// readers take their samples from there. References that close a cycle are
+// feedback edges: the reader sees the block before, a one block delay.
+class WaveGraph
+{
+public:
+    // Evaluation order: each wave comes after everything it reads,
+    // apart from feedback edges. The root is last.
+    std::vector<std::shared_ptr<Wave>> nodes;
+    // deps[i] are the nodes that have to finish the block before nodes[i]:
+    // the ones it reads, and the ones reading its previous block
+    std::vector<std::vector<int>> deps;
+    std::vector<std::vector<int>> dependents;
+    int feedback_edges;
+    // No node has more than one input or output, so nothing can run
+    // side by side
+    bool is_chain;
+    // Nodes with state a render can't be resumed from (native processors,
+    // oversampled waves' decimation filters and control-rate slots)
+    int stateful_nodes;
+
+    // The waves must already be simplified
+    WaveGraph(std::shared_ptr<Wave> root);
+    ~WaveGraph() {}
+
+private:
+    std::unordered_map<Wave*, int> index;
+
+    void add_edge(int from, int to);
+    void visit(std::shared_ptr<Wave> wave, std::unordered_map<Wave*, int>& state);
+};
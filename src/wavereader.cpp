@@ -0,0 +1,308 @@
+#include "wavereader.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#include <sys/stat.h>
+#endif
+
+static std::atomic<uint64_t> next_id(1);
+
+static uint16_t read_u16(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t read_u32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_u64(const unsigned char* p)
+{
+    return read_u32(p) | ((uint64_t)read_u32(p + 4) << 32);
+}
+
+WaveFile* WaveFile::open(const std::string& path, std::string& error)
+{
+    WaveFile* file = new WaveFile();
+    file->path = path;
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        error = "Could not open " + path + ".";
+        delete file;
+        return nullptr;
+    }
+    file->mtime = st.st_mtime;
+    file->map_size = st.st_size;
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "Could not open " + path + ".";
+        delete file;
+        return nullptr;
+    }
+    if (file->map_size > 0) {
+        file->map = mmap(nullptr, file->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file->map == MAP_FAILED) {
+            file->map = nullptr;
+        }
+    }
+    close(fd);
+#else
+    std::ifstream stream(path, std::ios::in | std::ios::binary);
+    if (stream) {
+        std::string* contents = new std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        file->map = contents;
+        file->map_size = contents->size();
+    }
+#endif
+
+    if (file->map == nullptr) {
+        error = "Could not read " + path + ".";
+        delete file;
+        return nullptr;
+    }
+
+    if (!file->parse(error)) {
+        error = path + ": " + error;
+        delete file;
+        return nullptr;
+    }
+
+    file->id = next_id++;
+    return file;
+}
+
+WaveFile::~WaveFile()
+{
+    if (map == nullptr) {
+        return;
+    }
+#ifndef _WIN32
+    munmap(map, map_size);
+#else
+    delete (std::string*)map;
+#endif
+}
+
+bool WaveFile::parse(std::string& error)
+{
+#ifndef _WIN32
+    const unsigned char* bytes = (const unsigned char*)map;
+#else
+    const unsigned char* bytes = (const unsigned char*)((std::string*)map)->data();
+#endif
+    size_t size = map_size;
+
+    if (size < 12 || memcmp(bytes + 8, "WAVE", 4) != 0) {
+        error = "not a WAV file.";
+        return false;
+    }
+    bool rf64 = memcmp(bytes, "RF64", 4) == 0 || memcmp(bytes, "BW64", 4) == 0;
+    if (!rf64 && memcmp(bytes, "RIFF", 4) != 0) {
+        error = "not a WAV file.";
+        return false;
+    }
+
+    // RF64 keeps the real data size in ds64, with 0xFFFFFFFF in the chunk
+    uint64_t ds64_data_size = 0;
+    const unsigned char* fmt = nullptr;
+    uint32_t fmt_size = 0;
+    const unsigned char* found_data = nullptr;
+    uint64_t data_size = 0;
+
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        const unsigned char* chunk = bytes + pos;
+        uint64_t chunk_size = read_u32(chunk + 4);
+
+        if (memcmp(chunk, "ds64", 4) == 0 && chunk_size >= 16 && pos + 24 <= size) {
+            ds64_data_size = read_u64(chunk + 16);
+        } else if (memcmp(chunk, "fmt ", 4) == 0) {
+            fmt = chunk + 8;
+            fmt_size = chunk_size;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (rf64 && chunk_size == 0xFFFFFFFF) {
+                chunk_size = ds64_data_size;
+            }
+            found_data = chunk + 8;
+            // Files cut short still play what's there
+            data_size = std::min<uint64_t>(chunk_size, size - pos - 8);
+            break;
+        }
+
+        // Chunks are padded to an even size
+        pos += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    if (fmt == nullptr || fmt_size < 16 || fmt + 16 > bytes + size) {
+        error = "no fmt chunk.";
+        return false;
+    }
+    if (found_data == nullptr) {
+        error = "no data chunk.";
+        return false;
+    }
+
+    uint16_t tag = read_u16(fmt);
+    channels = read_u16(fmt + 2);
+    sample_rate = read_u32(fmt + 4);
+    frame_bytes = read_u16(fmt + 12);
+    int bits = read_u16(fmt + 14);
+
+    // WAVE_FORMAT_EXTENSIBLE, the real tag starts the sub-format GUID
+    if (tag == 0xFFFE && fmt_size >= 40 && fmt + 40 <= bytes + size) {
+        tag = read_u16(fmt + 24);
+    }
+
+    if (tag == 1 && bits == 8) {
+        format = Format::Pcm8;
+    } else if (tag == 1 && bits == 16) {
+        format = Format::Pcm16;
+    } else if (tag == 1 && bits == 24) {
+        format = Format::Pcm24;
+    } else if (tag == 1 && bits == 32) {
+        format = Format::Pcm32;
+    } else if (tag == 3 && bits == 32) {
+        format = Format::Float32;
+    } else if (tag == 3 && bits == 64) {
+        format = Format::Float64;
+    } else {
+        error = "unsupported format (tag " + std::to_string(tag) + ", " + std::to_string(bits) + " bits).";
+        return false;
+    }
+
+    if (channels == 0 || frame_bytes < channels * bits / 8) {
+        error = "bad fmt chunk.";
+        return false;
+    }
+
+    uint64_t frame_count = data_size / frame_bytes;
+    if (frame_count > INT_MAX) {
+        error = "too long, at most " + std::to_string(INT_MAX) + " frames can be loaded.";
+        return false;
+    }
+
+    data = found_data;
+    frames = frame_count;
+    return true;
+}
+
+template <WaveFile::Format F>
+static inline float convert(const unsigned char* p)
+{
+    switch (F) {
+        case WaveFile::Format::Pcm8:
+            return (p[0] - 128) / 128.f;
+        case WaveFile::Format::Pcm16:
+            return (int16_t)read_u16(p) / 32768.f;
+        case WaveFile::Format::Pcm24:
+            return ((int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8) / 8388608.f;
+        case WaveFile::Format::Pcm32:
+            return (int32_t)read_u32(p) / 2147483648.f;
+        case WaveFile::Format::Float32: {
+            float value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+        case WaveFile::Format::Float64: {
+            double value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+    }
+    return 0.f;
+}
+
+template <WaveFile::Format F>
+static void convert_frames(const unsigned char* p, int frame_bytes, int channels, int count, float* out)
+{
+    int sample_bytes = F == WaveFile::Format::Pcm8 ? 1 : F == WaveFile::Format::Pcm16 ? 2
+        : F == WaveFile::Format::Pcm24 ? 3 : F == WaveFile::Format::Float64 ? 8 : 4;
+
+    if (channels == 1) {
+        for (int i = 0; i < count; i++, p += frame_bytes) {
+            out[i] = convert<F>(p);
+        }
+        return;
+    }
+
+    float scale = 1.f / channels;
+    for (int i = 0; i < count; i++, p += frame_bytes) {
+        float sum = 0.f;
+        for (int c = 0; c < channels; c++) {
+            sum += convert<F>(p + c * sample_bytes);
+        }
+        out[i] = sum * scale;
+    }
+}
+
+void WaveFile::read(int start, int count, float* out)
+{
+    const unsigned char* p = data + (size_t)start * frame_bytes;
+
+    switch (format) {
+        case Format::Pcm8:
+            convert_frames<Format::Pcm8>(p, frame_bytes, channels, count, out);
+            break;
+        case Format::Pcm16:
+            convert_frames<Format::Pcm16>(p, frame_bytes, channels, count, out);
+            break;
+        case Format::Pcm24:
+            convert_frames<Format::Pcm24>(p, frame_bytes, channels, count, out);
+            break;
+        case Format::Pcm32:
+            convert_frames<Format::Pcm32>(p, frame_bytes, channels, count, out);
+            break;
+        case Format::Float32:
+            convert_frames<Format::Float32>(p, frame_bytes, channels, count, out);
+            break;
+        case Format::Float64:
+            convert_frames<Format::Float64>(p, frame_bytes, channels, count, out);
+            break;
+    }
+}
+
+struct ConvertedBlock {
+    uint64_t id;
+    int index;
+    float samples[WAVE_READ_BLOCK];
+};
+
+float WaveFile::sample(int frame)
+{
+    static thread_local ConvertedBlock cache[WAVE_READ_CACHE];
+
+    int index = frame / WAVE_READ_BLOCK;
+    ConvertedBlock& block = cache[(id * 31 + index) % WAVE_READ_CACHE];
+
+    if (block.id != id || block.index != index) {
+        int start = index * WAVE_READ_BLOCK;
+        read(start, std::min(WAVE_READ_BLOCK, frames - start), block.samples);
+        block.id = id;
+        block.index = index;
+    }
+
+    return block.samples[frame - index * WAVE_READ_BLOCK];
+}
+
+uint64_t WaveFile::hash(uint64_t hash)
+{
+    hash = hash_string(path, hash);
+    hash = hash_value((uint64_t)map_size, hash);
+    return hash_value(mtime, hash);
+}
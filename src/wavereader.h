@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Frames converted to float at a time when reading a file sample by sample
+#define WAVE_READ_BLOCK 1024
+// Converted blocks kept per thread
+#define WAVE_READ_CACHE 16
+
+// A WAV file mapped into memory and read in place. Handles RIFF and RF64
+// (and BW64) files holding 8, 16, 24 or 32 bit PCM or 32 or 64 bit float,
+// plain or WAVE_FORMAT_EXTENSIBLE. Samples are mixed down to mono and
+// converted to float as they're read; nothing is copied up front.
+class WaveFile
+{
+public:
+    enum class Format { Pcm8, Pcm16, Pcm24, Pcm32, Float32, Float64 };
+
+    std::string path;
+    int channels;
+    int sample_rate;
+    // Per channel
+    int frames;
+
+    // Opens a file, or returns nullptr with a message in error
+    static WaveFile* open(const std::string& path, std::string& error);
+    ~WaveFile();
+
+    // Mono sample at frame, which must be in range. Goes through a small
+    // per thread cache of converted blocks, so playing a file converts each
+    // block once.
+    float sample(int frame);
+    // Converts count frames from start into out
+    void read(int start, int count, float* out);
+    // Identifies the file's contents for the render cache: path, size and
+    // modification time, rather than hashing what could be gigabytes
+    uint64_t hash(uint64_t hash);
+
+private:
+    Format format;
+    int frame_bytes;
+    const unsigned char* data;
+    // Unique per file opened, so cached blocks can't outlive theirs
+    uint64_t id;
+
+    void* map;
+    size_t map_size;
+    int64_t mtime;
+
+    WaveFile() : map(nullptr), map_size(0) {}
+    bool parse(std::string& error);
+};
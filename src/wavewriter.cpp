@@ -1,13 +1,45 @@
 #include "wavewriter.h"
+#include "stats.h"
 
-WaveBuffer::WaveBuffer() : length(0)
+#include <algorithm>
+#include <mutex>
+
+// Storage of buses that have been destroyed, handed to new ones so a process
+// running many scripts reuses memory that is already faulted in
+static std::mutex storage_mutex;
+static std::vector<std::vector<float>> free_storage;
+
+WaveBuffer::WaveBuffer() : length(0), limiter(nullptr) {}
+WaveBuffer::~WaveBuffer()
 {
-    data = new float[1000000];
+    AZ_LOG(Trace, Writer, "WaveBuffer destructor called!");
+    delete limiter;
+
+    if (data.capacity() > 0) {
+        std::lock_guard<std::mutex> lock(storage_mutex);
+        if (free_storage.size() < MAX_FREE_STORAGE) {
+            data.clear();
+            free_storage.push_back(std::move(data));
+        }
+    }
 }
-WaveBuffer::~WaveBuffer()
+
+void WaveBuffer::reserve(int length)
 {
-    std::cout << "WaveBuffer destructor called!\n";
-    delete [] data;
+    if (data.capacity() == 0) {
+        std::lock_guard<std::mutex> lock(storage_mutex);
+        if (!free_storage.empty()) {
+            data = std::move(free_storage.back());
+            free_storage.pop_back();
+        }
+    }
+
+    if (length > data.size()) {
+        if (Azurite::Stats::enabled) {
+            Azurite::Stats::count_alloc(AllocCategory::Buffer, (length - data.size()) * sizeof(float));
+        }
+        data.resize(length, 0.f);
+    }
 }
 
 struct wave16Header {
@@ -33,24 +65,56 @@ struct wave16Header {
         data_size(length * 2 * num_channels) {}
 };
 
+void stream_wave_buffer(WaveBuffer* buffer, std::function<void(const float*, int)> sink)
+{
+    if (buffer->limiter == nullptr) {
+        for (int pos = 0; pos < buffer->length; pos += WRITER_CHUNK) {
+            sink(buffer->data.data() + pos, std::min(WRITER_CHUNK, buffer->length - pos));
+        }
+        return;
+    }
+
+    // Run the limiter past the end to flush its delay line, and drop its
+    // first latency() samples so the output lines up with the input
+    Limiter* limiter = buffer->limiter;
+    limiter->reset();
+
+    int latency = limiter->latency();
+    std::vector<float> chunk(WRITER_CHUNK);
+
+    for (int pos = 0; pos < buffer->length + latency; pos += WRITER_CHUNK) {
+        for (int i = 0; i < WRITER_CHUNK; i++) {
+            chunk[i] = pos + i < buffer->length ? buffer->data[pos + i] : 0.f;
+        }
+        limiter->process(chunk.data(), chunk.data(), WRITER_CHUNK);
+
+        int first = std::max(0, latency - pos);
+        int last = std::min(WRITER_CHUNK, buffer->length + latency - pos);
+        if (last > first) {
+            sink(chunk.data() + first, last - first);
+        }
+    }
+}
+
 void write_wave_file(std::string filename, WaveBuffer* buffer, int num_channels)
 {
-    std::cout << "trying to write to wav\n";
+    AZ_LOG(Debug, Writer, "trying to write to wav " << filename);
     std::ofstream file(filename, std::ios::out | std::ios::binary);
 
     wave16Header header(buffer->length, num_channels);
+    file.write((const char*)&header, 44);
 
     // convert float buffer to short buffer
-    short* pcm_data = new short[1000000];
-    for (int i = 0; i < buffer->length; i++)
-    {
-        pcm_data[i] = (short) (((buffer->data[i] + 1.f) * 0.5f * 65535.f / 65536.f * 2.f - 1.f) * 32768); 
-    }
+    std::vector<short> pcm_data(WRITER_CHUNK);
 
-    file.write((const char*)&header, 44);
-    file.write((const char*)(pcm_data), header.data_size);
-
-    delete [] pcm_data;
+    stream_wave_buffer(buffer, [&](const float* samples, int count) {
+        for (int i = 0; i < count; i++) {
+            // Clip rather than wrap around
+            float sample = std::max(-1.f, std::min(1.f, samples[i]));
+            pcm_data[i] = (short) (((sample + 1.f) * 0.5f * 65535.f / 65536.f * 2.f - 1.f) * 32768); 
+        }
+        file.write((const char*)pcm_data.data(), count * 2);
+    });
 
     file.close();
-}
\ No newline at end of file
+}
@@ -1,14 +1,36 @@
+#pragma once
+
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <vector>
+
+#include "log.h"
+#include "limiter.h"
+
+// Samples converted and written at a time
+#define WRITER_CHUNK 4096
+// Bus storage kept around for reuse
+#define MAX_FREE_STORAGE 32
 
+// A mix bus. Every write() to the same name sums into one of these; names
+// ending in .wav are written out as files when the script ends.
 class WaveBuffer
 {
 public:
     int length;
-    float* data;
+    std::vector<float> data;
+    // Applied on the way out of the bus, if set. Owned.
+    Limiter* limiter;
 
     WaveBuffer();
     ~WaveBuffer();
+
+    // Grow to hold at least length samples
+    void reserve(int length);
 };
 
-void write_wave_file(std::string filename, WaveBuffer* buffer, int num_channels);
\ No newline at end of file
+// Feed the bus's final samples (after its limiter) to sink, a chunk at a time
+void stream_wave_buffer(WaveBuffer* buffer, std::function<void(const float*, int)> sink);
+
+void write_wave_file(std::string filename, WaveBuffer* buffer, int num_channels);